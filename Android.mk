@@ -131,6 +131,22 @@ ifeq ($(KERNELFLINGER_SUPPORT_KEYBOX_PROVISION),true)
     KERNELFLINGER_CFLAGS += -DFASTBOOT_KEYBOX_PROVISION
 endif
 
+ifeq ($(KERNELFLINGER_FASTBOOT_DOWNLOAD_ABOVE_4G),true)
+    KERNELFLINGER_CFLAGS += -DFASTBOOT_DOWNLOAD_ABOVE_4G
+endif
+
+ifeq ($(KERNELFLINGER_FASTBOOT_UDP),true)
+    KERNELFLINGER_CFLAGS += -DFASTBOOT_UDP
+endif
+
+ifneq ($(strip $(KERNELFLINGER_TCP_RX_TOKENS)),)
+    KERNELFLINGER_CFLAGS += -DTCP_RX_TOKENS=$(KERNELFLINGER_TCP_RX_TOKENS)
+endif
+
+ifneq ($(strip $(KERNELFLINGER_TRACE_ENTRIES)),)
+    KERNELFLINGER_CFLAGS += -DTRACE_ENTRIES=$(KERNELFLINGER_TRACE_ENTRIES)
+endif
+
 KERNELFLINGER_STATIC_LIBRARIES := \
 	libuefi_ssl_static \
 	libuefi_crypto_static \
@@ -84,6 +84,7 @@ LOCAL_SRC_FILES := \
     libavb/avb_property_descriptor.c \
     libavb/avb_rsa.c \
     libavb/avb_sha512.c \
+    libavb/avb_sha_accel.c \
     libavb/avb_slot_verify.c \
     libavb/avb_util.c \
     libavb/avb_vbmeta_image.c \
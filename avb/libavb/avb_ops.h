@@ -308,6 +308,27 @@ struct AvbOps {
                                         const char* name,
                                         size_t value_size,
                                         const uint8_t* value);
+
+  /* Gets the size of the image stored at the beginning of the partition
+   * with the name in |partition| (NUL-terminated UTF-8 string), as
+   * described by the image's own header. Returns the value in
+   * |out_size_num_bytes|.
+   *
+   * This is used when verification errors are allowed, to avoid loading
+   * and hashing the padding that follows the image. It is always called
+   * first: an AVB footer found at the end of the partition is only used
+   * when the image it describes is at least as large as this size,
+   * otherwise the whole partition is loaded. If the image format is not
+   * recognized, AVB_IO_RESULT_ERROR_NO_SUCH_VALUE should be returned and
+   * the whole partition is loaded.
+   *
+   * This function pointer can be set to NULL.
+   *
+   * Returns AVB_IO_RESULT_OK on success, otherwise an error code.
+   */
+  AvbIOResult (*get_image_size_of_partition)(AvbOps* ops,
+                                             const char* partition,
+                                             uint64_t* out_size_num_bytes);
 };
 
 #ifdef __cplusplus
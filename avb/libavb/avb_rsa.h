@@ -66,6 +66,19 @@ bool avb_rsa_verify(const uint8_t* key,
                     const uint8_t* padding,
                     size_t padding_num_bytes) AVB_ATTR_WARN_UNUSED_RESULT;
 
+/* Computes |inout| ^ 65537 modulo the key given by |key|, in place,
+ * |inout| being a big-endian number of |inout_num_bytes|, the size of
+ * the key modulus. 64-bit limbs are used when available unless
+ * |limbs64| is false. This lets tests compare the two implementations.
+ *
+ * Returns false if the key or the length of |inout| is invalid.
+ */
+bool avb_rsa_modpow(const uint8_t* key,
+                    size_t key_num_bytes,
+                    uint8_t* inout,
+                    size_t inout_num_bytes,
+                    bool limbs64) AVB_ATTR_WARN_UNUSED_RESULT;
+
 #ifdef __cplusplus
 }
 #endif
@@ -54,6 +54,7 @@ typedef struct {
   size_t len;
   uint8_t block[2 * AVB_SHA256_BLOCK_SIZE];
   uint8_t buf[AVB_SHA256_DIGEST_SIZE]; /* Used for storing the final digest. */
+  uint32_t accel; /* AVB_SHA_ACCEL_* extensions used by this context. */
 } AvbSHA256Ctx;
 
 /* Data structure used for SHA-512. */
@@ -83,6 +84,20 @@ void avb_sha512_update(AvbSHA512Ctx* ctx, const uint8_t* data, size_t len);
 /* Returns the SHA-512 digest. */
 uint8_t* avb_sha512_final(AvbSHA512Ctx* ctx) AVB_ATTR_WARN_UNUSED_RESULT;
 
+/* CPU extensions the SHA implementations can use instead of the
+ * portable C code, selected at runtime.
+ */
+#define AVB_SHA_ACCEL_SHA_NI (1 << 0) /* SHA-256 with the SHA extensions. */
+
+/* Returns the AVB_SHA_ACCEL_* extensions available on this CPU. */
+uint32_t avb_sha_accel(void);
+
+/* Initializes the SHA-256 context like avb_sha256_init() but only lets
+ * it use the available extensions in |accel_mask|. Passing 0 forces the
+ * portable C code. This is only meant for tests comparing both paths.
+ */
+void avb_sha256_init_accel(AvbSHA256Ctx* ctx, uint32_t accel_mask);
+
 #ifdef __cplusplus
 }
 #endif
@@ -131,11 +131,17 @@ void avb_sha256_init(AvbSHA256Ctx* ctx) {
 
   ctx->len = 0;
   ctx->tot_len = 0;
+  ctx->accel = avb_sha_accel();
 }
 
-static void SHA256_transform(AvbSHA256Ctx* ctx,
-                             const uint8_t* message,
-                             size_t block_nb) {
+void avb_sha256_init_accel(AvbSHA256Ctx* ctx, uint32_t accel_mask) {
+  avb_sha256_init(ctx);
+  ctx->accel &= accel_mask;
+}
+
+static void SHA256_transform_c(AvbSHA256Ctx* ctx,
+                               const uint8_t* message,
+                               size_t block_nb) {
   uint32_t w[64];
   uint32_t wv[8];
   uint32_t t1, t2;
@@ -332,6 +338,76 @@ static void SHA256_transform(AvbSHA256Ctx* ctx,
   }
 }
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/* Same as SHA256_transform_c() using the SHA extensions. The state is
+ * kept as ABEF/CDGH as required by SHA256RNDS2, each iteration runs
+ * four rounds and computes the next four message words.
+ */
+__attribute__((target("sha,sse4.1"))) static void SHA256_transform_shani(
+    AvbSHA256Ctx* ctx, const uint8_t* message, size_t block_nb) {
+  const __m128i bswap_mask =
+      _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i state0, state1, abef_save, cdgh_save, msg, tmp;
+  __m128i w[4];
+  size_t i, g;
+
+  tmp = _mm_loadu_si128((const __m128i*)&ctx->h[0]);
+  state1 = _mm_loadu_si128((const __m128i*)&ctx->h[4]);
+  tmp = _mm_shuffle_epi32(tmp, 0xB1);             /* CDAB */
+  state1 = _mm_shuffle_epi32(state1, 0x1B);       /* EFGH */
+  state0 = _mm_alignr_epi8(tmp, state1, 8);       /* ABEF */
+  state1 = _mm_blend_epi16(state1, tmp, 0xF0);    /* CDGH */
+
+  for (i = 0; i < block_nb; i++) {
+    abef_save = state0;
+    cdgh_save = state1;
+
+    for (g = 0; g < 16; g++) {
+      if (g < 4) {
+        w[g] = _mm_shuffle_epi8(
+            _mm_loadu_si128((const __m128i*)(message + (i << 6) + (g << 4))),
+            bswap_mask);
+      } else {
+        tmp = _mm_sha256msg1_epu32(w[g & 3], w[(g + 1) & 3]);
+        tmp = _mm_add_epi32(tmp,
+                            _mm_alignr_epi8(w[(g + 3) & 3], w[(g + 2) & 3], 4));
+        w[g & 3] = _mm_sha256msg2_epu32(tmp, w[(g + 3) & 3]);
+      }
+
+      msg = _mm_add_epi32(w[g & 3],
+                          _mm_loadu_si128((const __m128i*)&sha256_k[g << 2]));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+      msg = _mm_shuffle_epi32(msg, 0x0E);
+      state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+    }
+
+    state0 = _mm_add_epi32(state0, abef_save);
+    state1 = _mm_add_epi32(state1, cdgh_save);
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1B);          /* FEBA */
+  state1 = _mm_shuffle_epi32(state1, 0xB1);       /* DCHG */
+  state0 = _mm_blend_epi16(tmp, state1, 0xF0);    /* DCBA */
+  state1 = _mm_alignr_epi8(state1, tmp, 8);       /* HGFE */
+  _mm_storeu_si128((__m128i*)&ctx->h[0], state0);
+  _mm_storeu_si128((__m128i*)&ctx->h[4], state1);
+}
+#endif
+
+static void SHA256_transform(AvbSHA256Ctx* ctx,
+                             const uint8_t* message,
+                             size_t block_nb) {
+#if defined(__x86_64__) || defined(__i386__)
+  if (ctx->accel & AVB_SHA_ACCEL_SHA_NI) {
+    SHA256_transform_shani(ctx, message, block_nb);
+    return;
+  }
+#endif
+  SHA256_transform_c(ctx, message, block_nb);
+}
+
 void avb_sha256_update(AvbSHA256Ctx* ctx, const uint8_t* data, size_t len) {
   size_t block_nb;
   size_t new_len, rem_len, tmp_len;
@@ -141,6 +141,234 @@ static AvbSlotVerifyResult load_full_partition(AvbOps* ops,
   return AVB_SLOT_VERIFY_RESULT_OK;
 }
 
+/* Size of the chunks a hash partition is streamed in. Each chunk is hashed
+ * right after it has been read, while it is still in the cache, rather than
+ * hashing the whole image again once it has been loaded.
+ */
+#ifndef AVB_HASH_STREAM_CHUNK_SIZE
+#define AVB_HASH_STREAM_CHUNK_SIZE (1024 * 1024)
+#endif
+
+typedef struct {
+  bool use_sha512;
+  AvbSHA256Ctx sha256_ctx;
+  AvbSHA512Ctx sha512_ctx;
+} HashStreamCtx;
+
+static void hash_stream_update(HashStreamCtx* ctx,
+                               const uint8_t* data,
+                               size_t len) {
+  if (ctx->use_sha512) {
+    avb_sha512_update(&ctx->sha512_ctx, data, len);
+  } else {
+    avb_sha256_update(&ctx->sha256_ctx, data, len);
+  }
+}
+
+typedef struct {
+  HashStreamCtx* ctx;
+  const uint8_t* data;
+  size_t len;
+} HashStreamJob;
+
+static void hash_stream_job(void* arg) {
+  HashStreamJob* job = arg;
+  hash_stream_update(job->ctx, job->data, job->len);
+}
+
+/* Loads |image_size| bytes of |part_name| like load_full_partition() and
+ * feeds the first |hash_size| bytes to |hash_ctx|. Unless the partition is
+ * preloaded, it is read in AVB_HASH_STREAM_CHUNK_SIZE chunks which are
+ * hashed as they arrive so the image is only walked through once. When
+ * another processor is available, a chunk is hashed there while the next
+ * one is being read.
+ */
+static AvbSlotVerifyResult load_and_hash_partition(AvbOps* ops,
+                                                   const char* part_name,
+                                                   uint64_t image_size,
+                                                   uint64_t hash_size,
+                                                   HashStreamCtx* hash_ctx,
+                                                   uint8_t** out_image_buf,
+                                                   bool* out_image_preloaded) {
+  size_t part_num_read;
+  size_t offset;
+  size_t chunk;
+  AvbIOResult io_ret;
+  AvbSlotVerifyResult ret;
+  HashStreamJob job;
+  bool job_pending = false;
+
+  avb_assert(*out_image_buf == NULL);
+  avb_assert(!*out_image_preloaded);
+
+  if (image_size != (size_t)(image_size)) {
+    avb_errorv(part_name, ": Partition size too large to load.\n", NULL);
+    return AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
+  }
+
+  if (hash_size > image_size) {
+    avb_errorv(part_name, ": Hashed size larger than partition.\n", NULL);
+    return AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
+  }
+
+  /* A preloaded image is already in memory, hash it in one go. */
+  if (ops->get_preloaded_partition != NULL) {
+    io_ret = ops->get_preloaded_partition(
+        ops, part_name, image_size, out_image_buf, &part_num_read);
+    if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
+      return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+    } else if (io_ret != AVB_IO_RESULT_OK) {
+      avb_errorv(part_name, ": Error loading data from partition.\n", NULL);
+      return AVB_SLOT_VERIFY_RESULT_ERROR_IO;
+    }
+
+    if (*out_image_buf != NULL) {
+      if (part_num_read != image_size) {
+        avb_errorv(part_name, ": Read incorrect number of bytes.\n", NULL);
+        return AVB_SLOT_VERIFY_RESULT_ERROR_IO;
+      }
+      *out_image_preloaded = true;
+      hash_stream_update(hash_ctx, *out_image_buf, hash_size);
+      return AVB_SLOT_VERIFY_RESULT_OK;
+    }
+  }
+
+  *out_image_buf = avb_malloc(image_size);
+  if (*out_image_buf == NULL) {
+    return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+  }
+
+  ret = AVB_SLOT_VERIFY_RESULT_OK;
+  for (offset = 0; offset < image_size; offset += chunk) {
+    chunk = image_size - offset;
+    if (chunk > AVB_HASH_STREAM_CHUNK_SIZE) {
+      chunk = AVB_HASH_STREAM_CHUNK_SIZE;
+    }
+
+    io_ret = ops->read_from_partition(ops,
+                                      part_name,
+                                      offset,
+                                      chunk,
+                                      *out_image_buf + offset,
+                                      &part_num_read);
+    if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
+      ret = AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+      break;
+    } else if (io_ret != AVB_IO_RESULT_OK) {
+      avb_errorv(part_name, ": Error loading data from partition.\n", NULL);
+      ret = AVB_SLOT_VERIFY_RESULT_ERROR_IO;
+      break;
+    }
+    if (part_num_read != chunk) {
+      avb_errorv(part_name, ": Read incorrect number of bytes.\n", NULL);
+      ret = AVB_SLOT_VERIFY_RESULT_ERROR_IO;
+      break;
+    }
+
+    if (job_pending) {
+      avb_async_wait();
+      job_pending = false;
+    }
+
+    if (offset < hash_size) {
+      job.ctx = hash_ctx;
+      job.data = *out_image_buf + offset;
+      job.len = hash_size - offset < chunk ? hash_size - offset : chunk;
+      job_pending = avb_async_run(hash_stream_job, &job);
+      if (!job_pending) {
+        hash_stream_job(&job);
+      }
+    }
+  }
+
+  if (job_pending) {
+    avb_async_wait();
+  }
+
+  return ret;
+}
+
+/* Determines how much of |part_name| to load when verification errors are
+ * allowed. The image may have been replaced by one of a different size so
+ * |desc_image_size| cannot be trusted, and neither can an AVB footer left
+ * behind by a previous image. Rather than loading the entire partition, the
+ * size is taken from the image header, or from the AVB footer when the image
+ * described by the header fits inside it, and clamped between
+ * |desc_image_size| and the partition size. The entire partition is loaded
+ * when the header size is unknown or the two sizes disagree.
+ */
+static AvbSlotVerifyResult get_unverified_image_size(AvbOps* ops,
+                                                     const char* part_name,
+                                                     uint64_t desc_image_size,
+                                                     uint64_t* out_image_size) {
+  uint8_t footer_buf[AVB_FOOTER_SIZE];
+  AvbFooter footer;
+  size_t footer_num_read;
+  bool has_footer;
+  uint64_t part_size;
+  uint64_t header_size;
+  uint64_t image_size;
+  AvbIOResult io_ret;
+
+  io_ret = ops->get_size_of_partition(ops, part_name, &part_size);
+  if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
+    return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+  } else if (io_ret != AVB_IO_RESULT_OK) {
+    avb_errorv(part_name, ": Error determining partition size.\n", NULL);
+    return AVB_SLOT_VERIFY_RESULT_ERROR_IO;
+  }
+
+  image_size = part_size;
+  if (ops->get_image_size_of_partition == NULL) {
+    goto out;
+  }
+
+  io_ret = ops->get_image_size_of_partition(ops, part_name, &header_size);
+  if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
+    return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+  } else if (io_ret != AVB_IO_RESULT_OK) {
+    goto out;
+  }
+
+  io_ret = ops->read_from_partition(ops,
+                                    part_name,
+                                    -AVB_FOOTER_SIZE,
+                                    AVB_FOOTER_SIZE,
+                                    footer_buf,
+                                    &footer_num_read);
+  if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
+    return AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
+  }
+  has_footer = io_ret == AVB_IO_RESULT_OK &&
+               footer_num_read == AVB_FOOTER_SIZE &&
+               avb_footer_validate_and_byteswap(
+                   (const AvbFooter*)footer_buf, &footer);
+
+  if (!has_footer) {
+    avb_debugv(part_name, ": Loading image sized from its header.\n", NULL);
+    image_size = header_size;
+  } else if (header_size <= footer.original_image_size) {
+    avb_debugv(part_name, ": Loading image sized from AVB footer.\n", NULL);
+    image_size = footer.original_image_size;
+  } else {
+    avb_debugv(part_name, ": AVB footer does not match the image.\n", NULL);
+  }
+
+out:
+  if (image_size < desc_image_size) {
+    image_size = desc_image_size;
+  }
+  if (image_size > part_size) {
+    image_size = part_size;
+  }
+  if (image_size == part_size) {
+    avb_debugv(part_name, ": Loading entire partition.\n", NULL);
+  }
+
+  *out_image_size = image_size;
+  return AVB_SLOT_VERIFY_RESULT_OK;
+}
+
 /* Reads a persistent digest stored as a named persistent value corresponding to
  * the given |part_name|. The value is returned in |out_digest| which must point
  * to |expected_digest_size| bytes. If there is no digest stored for |part_name|
@@ -288,7 +516,6 @@ static AvbSlotVerifyResult load_and_verify_hash_partition(
   const uint8_t* desc_digest;
   char part_name[AVB_PART_NAME_MAX_SIZE];
   AvbSlotVerifyResult ret;
-  AvbIOResult io_ret;
   uint8_t* image_buf = NULL;
   bool image_preloaded = false;
   uint8_t* digest;
@@ -298,6 +525,7 @@ static AvbSlotVerifyResult load_and_verify_hash_partition(
   size_t expected_digest_len = 0;
   uint8_t expected_digest_buf[AVB_SHA512_DIGEST_SIZE];
   const uint8_t* expected_digest = NULL;
+  HashStreamCtx hash_ctx;
 
   if (!avb_hash_descriptor_validate_and_byteswap(
           (const AvbHashDescriptor*)descriptor, &hash_desc)) {
@@ -360,7 +588,7 @@ static AvbSlotVerifyResult load_and_verify_hash_partition(
 
   /* If we're allowing verification errors then hash_desc.image_size
    * may no longer match what's in the partition... so in this case
-   * just load the entire partition.
+   * size the load from the image actually flashed.
    *
    * For example, this can happen if a developer does 'fastboot flash
    * boot /path/to/new/and/bigger/boot.img'. We want this to work
@@ -368,43 +596,44 @@ static AvbSlotVerifyResult load_and_verify_hash_partition(
    */
   image_size = hash_desc.image_size;
   if (allow_verification_error) {
-    io_ret = ops->get_size_of_partition(ops, part_name, &image_size);
-    if (io_ret == AVB_IO_RESULT_ERROR_OOM) {
-      ret = AVB_SLOT_VERIFY_RESULT_ERROR_OOM;
-      goto out;
-    } else if (io_ret != AVB_IO_RESULT_OK) {
-      avb_errorv(part_name, ": Error determining partition size.\n", NULL);
-      ret = AVB_SLOT_VERIFY_RESULT_ERROR_IO;
+    ret = get_unverified_image_size(
+        ops, part_name, hash_desc.image_size, &image_size);
+    if (ret != AVB_SLOT_VERIFY_RESULT_OK) {
       goto out;
     }
-    avb_debugv(part_name, ": Loading entire partition.\n", NULL);
-  }
-
-  ret = load_full_partition(
-      ops, part_name, image_size, &image_buf, &image_preloaded);
-  if (ret != AVB_SLOT_VERIFY_RESULT_OK) {
-    goto out;
   }
 
   if (avb_strcmp((const char*)hash_desc.hash_algorithm, "sha256") == 0) {
-    AvbSHA256Ctx sha256_ctx;
-    avb_sha256_init(&sha256_ctx);
-    avb_sha256_update(&sha256_ctx, desc_salt, hash_desc.salt_len);
-    avb_sha256_update(&sha256_ctx, image_buf, hash_desc.image_size);
-    digest = avb_sha256_final(&sha256_ctx);
-    digest_len = AVB_SHA256_DIGEST_SIZE;
+    hash_ctx.use_sha512 = false;
+    avb_sha256_init(&hash_ctx.sha256_ctx);
   } else if (avb_strcmp((const char*)hash_desc.hash_algorithm, "sha512") == 0) {
-    AvbSHA512Ctx sha512_ctx;
-    avb_sha512_init(&sha512_ctx);
-    avb_sha512_update(&sha512_ctx, desc_salt, hash_desc.salt_len);
-    avb_sha512_update(&sha512_ctx, image_buf, hash_desc.image_size);
-    digest = avb_sha512_final(&sha512_ctx);
-    digest_len = AVB_SHA512_DIGEST_SIZE;
+    hash_ctx.use_sha512 = true;
+    avb_sha512_init(&hash_ctx.sha512_ctx);
   } else {
     avb_errorv(part_name, ": Unsupported hash algorithm.\n", NULL);
     ret = AVB_SLOT_VERIFY_RESULT_ERROR_INVALID_METADATA;
     goto out;
   }
+  hash_stream_update(&hash_ctx, desc_salt, hash_desc.salt_len);
+
+  ret = load_and_hash_partition(ops,
+                                part_name,
+                                image_size,
+                                hash_desc.image_size,
+                                &hash_ctx,
+                                &image_buf,
+                                &image_preloaded);
+  if (ret != AVB_SLOT_VERIFY_RESULT_OK) {
+    goto out;
+  }
+
+  if (hash_ctx.use_sha512) {
+    digest = avb_sha512_final(&hash_ctx.sha512_ctx);
+    digest_len = AVB_SHA512_DIGEST_SIZE;
+  } else {
+    digest = avb_sha256_final(&hash_ctx.sha256_ctx);
+    digest_len = AVB_SHA256_DIGEST_SIZE;
+  }
 
   if (hash_desc.digest_len == 0) {
     /* Expect a match to a persistent digest. */
@@ -1514,6 +1743,7 @@ AvbSlotVerifyResult avb_slot_verify(AvbOps* ops,
     avb_assert(ret == AVB_SLOT_VERIFY_RESULT_OK);
   }
 
+  avb_async_stop();
   return ret;
 
 fail:
@@ -1523,6 +1753,7 @@ fail:
   if (additional_cmdline_subst != NULL) {
     avb_free_cmdline_subst_list(additional_cmdline_subst);
   }
+  avb_async_stop();
   return ret;
 }
 
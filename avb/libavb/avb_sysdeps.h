@@ -132,6 +132,28 @@ size_t avb_strlen(const char* str) AVB_ATTR_WARN_UNUSED_RESULT;
  * remainder. */
 uint32_t avb_div_by_10(uint64_t* dividend);
 
+/* Runs |func| with |arg| on another processor, concurrently with the
+ * caller. Returns false if no other processor is available, in which
+ * case |func| has not been run and the caller should run it itself.
+ *
+ * Only one job runs at a time: avb_async_wait() must be called before
+ * running the next one and before touching anything |func| uses. |func|
+ * must not call into the firmware nor allocate memory.
+ */
+bool avb_async_run(void (*func)(void* arg), void* arg);
+
+/* Waits for the job started by avb_async_run() to complete. */
+void avb_async_wait(void);
+
+/* Waits for the last job and releases the processor it ran on. */
+void avb_async_stop(void);
+
+/* Processor features which can be used instead of portable code. */
+#define AVB_CPU_FEATURE_SHA_NI (1 << 0) /* x86 SHA extensions. */
+
+/* Returns the AVB_CPU_FEATURE_* flags supported by the processor. */
+uint32_t avb_cpu_features(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -84,3 +84,15 @@ uint32_t avb_div_by_10(uint64_t* dividend) {
   *dividend /= 10;
   return rem;
 }
+
+bool avb_async_run(void (*func)(void* arg), void* arg) {
+  return false;
+}
+
+void avb_async_wait(void) {}
+
+void avb_async_stop(void) {}
+
+uint32_t avb_cpu_features(void) {
+  return 0;
+}
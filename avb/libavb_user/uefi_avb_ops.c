@@ -31,6 +31,7 @@
 #include "lib.h"
 #include "log.h"
 #include "security.h"
+#include "android.h"
 #ifdef USE_TPM
 #include "tpm2_security.h"
 #endif
@@ -49,7 +50,7 @@ static AvbIOResult read_from_partition(__attribute__((unused)) AvbOps* ops,
   EFI_STATUS efi_ret;
   struct gpt_partition_interface gpart;
   int64_t partition_size;
-  const CHAR16 *label;
+  CHAR16 *label;
 
   avb_assert(partition_name != NULL);
   avb_assert(buf != NULL);
@@ -65,8 +66,10 @@ static AvbIOResult read_from_partition(__attribute__((unused)) AvbOps* ops,
   efi_ret = gpt_get_partition_by_label(label, &gpart, LOGICAL_UNIT_USER);
   if (EFI_ERROR(efi_ret)) {
     error(L"Partition %s not found", label);
+    FreePool(label);
     return AVB_IO_RESULT_ERROR_NO_SUCH_PARTITION;
   }
+  FreePool(label);
 
   partition_size =
       (gpart.part.ending_lba - gpart.part.starting_lba + 1) *
@@ -114,7 +117,7 @@ static AvbIOResult write_to_partition(__attribute__((unused)) AvbOps* ops,
   EFI_STATUS efi_ret;
   struct gpt_partition_interface gpart;
   uint64_t partition_size;
-  const CHAR16 * label;
+  CHAR16 *label;
 
   avb_assert(partition_name != NULL);
   avb_assert(buf != NULL);
@@ -128,8 +131,10 @@ static AvbIOResult write_to_partition(__attribute__((unused)) AvbOps* ops,
   efi_ret = gpt_get_partition_by_label(label, &gpart, LOGICAL_UNIT_USER);
   if (EFI_ERROR(efi_ret)) {
     error(L"Partition %s not found", label);
+    FreePool(label);
     return AVB_IO_RESULT_ERROR_NO_SUCH_PARTITION;
   }
+  FreePool(label);
 
   partition_size =
       (gpart.part.ending_lba - gpart.part.starting_lba + 1) *
@@ -175,7 +180,7 @@ static AvbIOResult get_size_of_partition(__attribute__((unused)) AvbOps* ops,
   EFI_STATUS efi_ret;
   struct gpt_partition_interface gpart;
   uint64_t partition_size;
-  const CHAR16 * label;
+  CHAR16 *label;
 
   avb_assert(partition_name != NULL);
 
@@ -188,8 +193,10 @@ static AvbIOResult get_size_of_partition(__attribute__((unused)) AvbOps* ops,
   efi_ret = gpt_get_partition_by_label(label, &gpart, LOGICAL_UNIT_USER);
   if (EFI_ERROR(efi_ret)) {
     error(L"Partition %s not found", label);
+    FreePool(label);
     return AVB_IO_RESULT_ERROR_NO_SUCH_PARTITION;
   }
+  FreePool(label);
 
   partition_size =
       (gpart.part.ending_lba - gpart.part.starting_lba + 1) *
@@ -202,6 +209,40 @@ static AvbIOResult get_size_of_partition(__attribute__((unused)) AvbOps* ops,
   return AVB_IO_RESULT_OK;
 }
 
+static AvbIOResult get_image_size_of_partition(AvbOps* ops,
+                                               const char* partition_name,
+                                               uint64_t* out_size) {
+  AvbIOResult io_ret;
+  uint8_t* hdr;
+  size_t num_read;
+  UINTN image_size;
+
+  avb_assert(partition_name != NULL);
+  avb_assert(out_size != NULL);
+
+  hdr = avb_malloc(BOOT_IMG_HEADER_SIZE_V3);
+  if (!hdr) {
+    return AVB_IO_RESULT_ERROR_OOM;
+  }
+
+  io_ret = read_from_partition(ops, partition_name, 0,
+                               BOOT_IMG_HEADER_SIZE_V3, hdr, &num_read);
+  if (io_ret != AVB_IO_RESULT_OK)
+    goto out;
+
+  if (num_read != BOOT_IMG_HEADER_SIZE_V3 ||
+      EFI_ERROR(android_image_size(hdr, &image_size))) {
+    io_ret = AVB_IO_RESULT_ERROR_NO_SUCH_VALUE;
+    goto out;
+  }
+
+  *out_size = image_size;
+
+out:
+  avb_free(hdr);
+  return io_ret;
+}
+
 static AvbIOResult validate_vbmeta_public_key(
     __attribute__((unused)) AvbOps* ops,
     const uint8_t* public_key_data,
@@ -302,7 +343,7 @@ static AvbIOResult get_unique_guid_for_partition(__attribute__((unused)) AvbOps*
   EFI_STATUS efi_ret;
   struct gpt_partition_interface gpart;
   uint8_t * unique_guid;
-  const CHAR16 * label;
+  CHAR16 *label;
 
 
 
@@ -318,8 +359,10 @@ static AvbIOResult get_unique_guid_for_partition(__attribute__((unused)) AvbOps*
   efi_ret = gpt_get_partition_by_label(label, &gpart, LOGICAL_UNIT_USER);
   if (EFI_ERROR(efi_ret)) {
     error(L"Partition %s not found", label);
+    FreePool(label);
     return AVB_IO_RESULT_ERROR_IO;
   }
+  FreePool(label);
 
   if (guid_buf_size < 37) {
     avb_error("GUID buffer size too small.\n");
@@ -375,6 +418,7 @@ AvbOps* uefi_avb_ops_new(void) {
   data->ops.read_from_partition = read_from_partition;
   data->ops.write_to_partition = write_to_partition;
   data->ops.get_size_of_partition = get_size_of_partition;
+  data->ops.get_image_size_of_partition = get_image_size_of_partition;
   data->ops.validate_vbmeta_public_key = validate_vbmeta_public_key;
   data->ops.read_rollback_index = read_rollback_index;
   data->ops.write_rollback_index = write_rollback_index;
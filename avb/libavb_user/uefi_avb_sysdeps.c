@@ -32,6 +32,7 @@
 #include "lib.h"
 #include "log.h"
 #include "ui.h"
+#include "mp_services.h"
 
 int avb_memcmp(const void* src1, const void* src2, size_t n) {
   return (int)CompareMem((VOID*)src1, (VOID*)src2, (UINTN)n);
@@ -136,3 +137,145 @@ uint32_t avb_div_by_10(uint64_t* dividend) {
   *dividend /= 10;
   return rem;
 }
+
+/* Jobs are run by a single application processor which loops in
+ * async_worker() until avb_async_stop() is called, so that starting a
+ * job costs a memory write rather than a firmware call.
+ */
+static struct {
+  MP_SERVICES_PROTOCOL* mp;
+  EFI_EVENT event;
+  UINTN ap;
+  BOOLEAN unavailable;
+  volatile BOOLEAN running;
+  volatile BOOLEAN quit;
+  void (*volatile func)(void* arg);
+  void* volatile arg;
+} async;
+
+static VOID EFIAPI async_worker(__attribute__((unused)) VOID* unused) {
+  void (*func)(void* arg);
+
+  for (;;) {
+    func = async.func;
+    if (func) {
+      func(async.arg);
+      __sync_synchronize();
+      async.func = NULL;
+      continue;
+    }
+    if (async.quit)
+      break;
+    asm volatile("pause");
+  }
+
+  __sync_synchronize();
+  async.running = FALSE;
+}
+
+static BOOLEAN async_init(void) {
+  EFI_GUID mp_guid = EFI_MP_SERVICES_PROTOCOL_GUID;
+  UINTN nr_cpus, nr_enabled, bsp;
+  EFI_STATUS ret;
+
+  ret = LibLocateProtocol(&mp_guid, (VOID**)&async.mp);
+  if (EFI_ERROR(ret) || !async.mp)
+    return FALSE;
+
+  ret = uefi_call_wrapper(
+      async.mp->GetNumberOfProcessors, 3, async.mp, &nr_cpus, &nr_enabled);
+  if (EFI_ERROR(ret) || nr_enabled < 2)
+    return FALSE;
+
+  ret = uefi_call_wrapper(async.mp->WhoAmI, 2, async.mp, &bsp);
+  if (EFI_ERROR(ret))
+    return FALSE;
+  async.ap = bsp == 0 ? 1 : 0;
+
+  /* The event makes StartupThisAP() non-blocking. */
+  ret = uefi_call_wrapper(BS->CreateEvent, 5, 0, 0, NULL, NULL, &async.event);
+  if (EFI_ERROR(ret))
+    return FALSE;
+
+  return TRUE;
+}
+
+static BOOLEAN async_start(void) {
+  EFI_STATUS ret;
+
+  if (async.running)
+    return TRUE;
+  if (async.unavailable)
+    return FALSE;
+
+  if (!async.event && !async_init()) {
+    async.unavailable = TRUE;
+    return FALSE;
+  }
+
+  /* Reset the event in case the previous run was signaled. */
+  uefi_call_wrapper(BS->CheckEvent, 1, async.event);
+
+  async.quit = FALSE;
+  async.func = NULL;
+  async.running = TRUE;
+  ret = uefi_call_wrapper(async.mp->StartupThisAP, 7, async.mp, async_worker,
+                          async.ap, async.event, 0, NULL, NULL);
+  if (EFI_ERROR(ret)) {
+    async.running = FALSE;
+    /* The firmware may not have noticed yet that the previous run
+     * completed, try again next time. */
+    if (ret != EFI_NOT_READY) {
+      efi_perror(ret, L"Failed to start the hashing processor");
+      async.unavailable = TRUE;
+    }
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+bool avb_async_run(void (*func)(void* arg), void* arg) {
+  if (!async_start())
+    return false;
+
+  async.arg = arg;
+  __sync_synchronize();
+  async.func = func;
+  return true;
+}
+
+void avb_async_wait(void) {
+  while (async.func)
+    asm volatile("pause");
+  __sync_synchronize();
+}
+
+void avb_async_stop(void) {
+  if (!async.running)
+    return;
+
+  avb_async_wait();
+  async.quit = TRUE;
+  while (async.running)
+    asm volatile("pause");
+}
+
+#define CPUID_7_EBX_SHA (1 << 29)
+
+uint32_t avb_cpu_features(void) {
+  UINT32 reg[4];
+  uint32_t features = 0;
+
+  cpuid(0, reg);
+  if (reg[0] < 7) {
+    return 0;
+  }
+
+  cpuid_count(7, 0, reg);
+  if (reg[1] & CPUID_7_EBX_SHA) {
+    features |= AVB_CPU_FEATURE_SHA_NI;
+  }
+
+  return features;
+}
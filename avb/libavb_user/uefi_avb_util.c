@@ -23,6 +23,8 @@
  */
 
 #include "uefi_avb_util.h"
+#include "libavb/avb_rsa.h"
+#include "libavb/avb_sha.h"
 
 bool uefi_avb_utf8_to_ucs2(const uint8_t* utf8_data,
                            size_t utf8_num_bytes,
@@ -64,3 +66,26 @@ bool uefi_avb_utf8_to_ucs2(const uint8_t* utf8_data,
   }
   return true;
 }
+
+uint32_t uefi_avb_sha256(const uint8_t* data,
+                         size_t len,
+                         size_t split,
+                         uint32_t accel_mask,
+                         uint8_t* digest) {
+  AvbSHA256Ctx ctx;
+
+  avb_sha256_init_accel(&ctx, accel_mask);
+  avb_sha256_update(&ctx, data, split);
+  avb_sha256_update(&ctx, data + split, len - split);
+  avb_memcpy(digest, avb_sha256_final(&ctx), AVB_SHA256_DIGEST_SIZE);
+
+  return ctx.accel;
+}
+
+bool uefi_avb_rsa_modpow(const uint8_t* key,
+                         size_t key_num_bytes,
+                         uint8_t* inout,
+                         size_t inout_num_bytes,
+                         bool limbs64) {
+  return avb_rsa_modpow(key, key_num_bytes, inout, inout_num_bytes, limbs64);
+}
@@ -38,4 +38,27 @@ bool uefi_avb_utf8_to_ucs2(const uint8_t* utf8_data,
                            size_t ucs2_data_capacity_num_bytes,
                            size_t* out_ucs2_data_num_bytes);
 
+/* Computes the SHA-256 of |len| bytes of |data| into |digest|, fed to
+ * the hash in two updates split at |split|, using only the hardware
+ * extensions in |accel_mask| (0 for the portable C code). Returns the
+ * extensions which were used. This lets tests compare the accelerated
+ * and the portable implementations.
+ */
+uint32_t uefi_avb_sha256(const uint8_t* data,
+                         size_t len,
+                         size_t split,
+                         uint32_t accel_mask,
+                         uint8_t* digest);
+
+/* Computes |inout| ^ 65537 modulo the AVB public key |key| in place,
+ * with 64-bit limbs when available if |limbs64| is true and with 32-bit
+ * limbs otherwise. This lets tests compare the two implementations.
+ * Returns false if the key or the length of |inout| is invalid.
+ */
+bool uefi_avb_rsa_modpow(const uint8_t* key,
+                         size_t key_num_bytes,
+                         uint8_t* inout,
+                         size_t inout_num_bytes,
+                         bool limbs64);
+
 #endif /* UEFI_AVB_UTIL_H_ */
@@ -170,6 +170,7 @@ set(LIB_FASTBOOT_SOURCES
 	#${LIB_FASTBOOT_SOURCE}/fastboot_oem.c
 	${LIB_FASTBOOT_SOURCE}/fastboot_flashing.c
 	${LIB_FASTBOOT_SOURCE}/flash.c
+	${LIB_FASTBOOT_SOURCE}/flash_profile.c
 	${LIB_FASTBOOT_SOURCE}/sparse.c
 	${LIB_FASTBOOT_SOURCE}/info.c
 	${LIB_FASTBOOT_SOURCE}/intel_variables.c
@@ -177,6 +178,7 @@ set(LIB_FASTBOOT_SOURCES
 	${LIB_FASTBOOT_SOURCE}/hashes.c
 	${LIB_FASTBOOT_SOURCE}/bootloader.c
 	${LIB_FASTBOOT_SOURCE}/fastboot_transport.c
+	${LIB_FASTBOOT_SOURCE}/fastboot_udp.c
 	${LIB_FASTBOOT_SOURCE}/fastboot_ui.c
 	)
 
@@ -192,6 +194,7 @@ set(LIB_KERNELFLINGER_SOURCES
 	${LIB_KERNELFLINGER_SOURCE}/em.c
 	${LIB_KERNELFLINGER_SOURCE}/gpt.c
 	${LIB_KERNELFLINGER_SOURCE}/storage.c
+	${LIB_KERNELFLINGER_SOURCE}/aio.c
 	${LIB_KERNELFLINGER_SOURCE}/pci.c
 	${LIB_KERNELFLINGER_SOURCE}/mmc.c
 	${LIB_KERNELFLINGER_SOURCE}/ufs.c
@@ -208,6 +211,7 @@ set(LIB_KERNELFLINGER_SOURCES
 	${LIB_KERNELFLINGER_SOURCE}/qsort.c
 	${LIB_KERNELFLINGER_SOURCE}/nvme.c
 	${LIB_KERNELFLINGER_SOURCE}/timer.c
+	${LIB_KERNELFLINGER_SOURCE}/trace.c
 	${LIB_KERNELFLINGER_SOURCE}/virtual_media.c
 	${LIB_KERNELFLINGER_SOURCE}/general_block.c
 	${LIB_KERNELFLINGER_SOURCE}/slot.c
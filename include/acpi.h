@@ -68,14 +68,21 @@ struct XSDT_TABLE {
 	UINT64 entry[1];		/* Table Entries */
 };
 
-/* Minimal definition of the FACP to get the DSDT memory address. */
+/* Minimal definition of the FACP to get the DSDT memory address and
+   the power management timer. */
 struct FACP_TABLE {
 	struct ACPI_DESC_HEADER header;
 	UINT32 firmware_ctrl;		/* Physical memory address of the FACS. */
 	UINT32 DSDT;			/* Physical memory address (0-4 GB) of the DSDT. */
+	CHAR8 reserved1[32];		/* [...] */
+	UINT32 pm_tmr_blk;		/* I/O port of the power management timer. */
+	CHAR8 reserved2[32];		/* [...] */
+	UINT32 flags;			/* Fixed feature flags. */
 					/* [...] */
 };
 
+#define FACP_FLAG_TMR_VAL_EXT	(1 << 8)	/* 32 bits PM timer */
+
 struct RSCI_TABLE {
 	struct ACPI_DESC_HEADER header;
 	CHAR8 wake_source;		/* How system woken up from S4 or S5 */
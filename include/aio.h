@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2022, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _AIO_H_
+#define _AIO_H_
+
+#include <efi.h>
+
+/* Asynchronous block writes through EFI_BLOCK_IO2_PROTOCOL.  When
+   the firmware does not provide it, writes are synchronously
+   performed with EFI_BLOCK_IO_PROTOCOL.
+
+   Each write is identified by a sequence number.  The buffer of a
+   write must not be modified or freed until aio_wait() has been
+   called with its sequence number, or until aio_flush().  Writes
+   must not overlap each other while they are in flight: they may
+   complete in any order. */
+struct aio;
+
+EFI_STATUS aio_open(EFI_BLOCK_IO *bio, struct aio **aio);
+EFI_STATUS aio_write(struct aio *aio, EFI_LBA lba, UINTN size, VOID *data, UINT64 *seq);
+EFI_STATUS aio_wait(struct aio *aio, UINT64 seq);
+EFI_STATUS aio_flush(struct aio *aio);
+EFI_STATUS aio_close(struct aio *aio);
+
+#endif	/* _AIO_H_ */
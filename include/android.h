@@ -531,6 +531,13 @@ EFI_STATUS write_bcb(
 /* Perform a security  RAM wipe */
 EFI_STATUS android_clear_memory(void);
 
+#ifdef __LP64__
+/* Clear BUF, LEN being a multiple of EFI_PAGE_SIZE, the way
+   android_clear_memory() does, with all the processors if USE_MP is
+   TRUE or with the boot processor only otherwise. */
+EFI_STATUS android_clear_buffer(VOID *buf, UINT64 len, BOOLEAN use_mp);
+#endif
+
 /* True if the current Android configuration use slot and does not
  * have a recovery partition.  When true, it means that the current
  * Android configuration requires to boot using the system partiton as
@@ -547,6 +554,12 @@ struct boot_img_hdr *get_bootimage_header(VOID *bootimage_blob);
  * block */
 UINTN bootimage_size(struct boot_img_hdr *aosp_header);
 
+/* Compute in SIZE the size of the boot or vendor_boot image whose
+ * header is at IMAGE_HDR, which must be at least
+ * BOOT_IMG_HEADER_SIZE_V3 bytes long.  Returns EFI_UNSUPPORTED if
+ * the header magic is not recognized. */
+EFI_STATUS android_image_size(VOID *image_hdr, UINTN *size);
+
 /* Return the blob_size aligned on hdr->page_size.  */
 UINT32 pagealign(struct boot_img_hdr *hdr, UINT32 blob_size);
 
@@ -82,6 +82,11 @@ EFI_STATUS fastboot_stop(void *bootimage, void *efiimage, UINTN imagesize,
 			 enum boot_target target);
 void fastboot_free(void);
 EFI_STATUS refresh_partition_var(void);
+EFI_STATUS fastboot_set_flash_stream(CHAR8 *label);
+EFI_STATUS fastboot_stream_open(CHAR8 *label);
+EFI_STATUS fastboot_stream_write(void *data, UINTN size);
+EFI_STATUS fastboot_stream_close(void);
+void fastboot_stream_abort(void);
 
 void fastboot_reboot(enum boot_target target, CHAR16 *msg);
 
@@ -257,6 +257,9 @@ UINT64 efi_time_to_ctime(EFI_TIME *time);
 
 VOID cpuid(UINT32 op, UINT32 reg[4]);
 
+/* Same as cpuid() for the leaves which take a sub-leaf in ECX. */
+VOID cpuid_count(UINT32 op, UINT32 count, UINT32 reg[4]);
+
 EFI_STATUS generate_random_numbers(CHAR8 *data, UINTN size);
 
 BOOLEAN no_device_unlock();
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2022, Intel Corporation
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _MP_SERVICES_H_
+#define _MP_SERVICES_H_
+
+#include <efi.h>
+
+/* Subset of the PI specification EFI_MP_SERVICES_PROTOCOL. */
+
+#define EFI_MP_SERVICES_PROTOCOL_GUID \
+	{0x3fdda605, 0xa76e, 0x4f46, {0xad, 0x29, 0x12, 0xf4, 0x53, 0x1b, 0x3d, 0x08}}
+
+typedef struct _MP_SERVICES_PROTOCOL MP_SERVICES_PROTOCOL;
+
+typedef VOID (EFIAPI *MP_AP_PROCEDURE)(VOID *arg);
+
+typedef
+EFI_STATUS
+(EFIAPI *MP_GET_NUMBER_OF_PROCESSORS) (
+	IN MP_SERVICES_PROTOCOL *This,
+	OUT UINTN *NumberOfProcessors,
+	OUT UINTN *NumberOfEnabledProcessors
+	);
+
+typedef
+EFI_STATUS
+(EFIAPI *MP_STARTUP_ALL_APS) (
+	IN MP_SERVICES_PROTOCOL *This,
+	IN MP_AP_PROCEDURE Procedure,
+	IN BOOLEAN SingleThread,
+	IN EFI_EVENT WaitEvent OPTIONAL,
+	IN UINTN TimeoutInMicroSeconds,
+	IN VOID *ProcedureArgument OPTIONAL,
+	OUT UINTN **FailedCpuList OPTIONAL
+	);
+
+typedef
+EFI_STATUS
+(EFIAPI *MP_STARTUP_THIS_AP) (
+	IN MP_SERVICES_PROTOCOL *This,
+	IN MP_AP_PROCEDURE Procedure,
+	IN UINTN ProcessorNumber,
+	IN EFI_EVENT WaitEvent OPTIONAL,
+	IN UINTN TimeoutInMicroseconds,
+	IN VOID *ProcedureArgument OPTIONAL,
+	OUT BOOLEAN *Finished OPTIONAL
+	);
+
+typedef
+EFI_STATUS
+(EFIAPI *MP_WHO_AM_I) (
+	IN MP_SERVICES_PROTOCOL *This,
+	OUT UINTN *ProcessorNumber
+	);
+
+struct _MP_SERVICES_PROTOCOL {
+	MP_GET_NUMBER_OF_PROCESSORS GetNumberOfProcessors;
+	VOID *GetProcessorInfo;
+	MP_STARTUP_ALL_APS StartupAllAPs;
+	MP_STARTUP_THIS_AP StartupThisAP;
+	VOID *SwitchBSP;
+	VOID *EnableDisableAP;
+	MP_WHO_AM_I WhoAmI;
+};
+
+#endif	/* _MP_SERVICES_H_ */
@@ -43,5 +43,7 @@ EFI_STATUS tcp_stop(void);
 EFI_STATUS tcp_run(void);
 EFI_STATUS tcp_read(void *buf, UINT32 size);
 EFI_STATUS tcp_write(void *buf, UINT32 size);
+EFI_STATUS tcp_write_with_header(void *header, UINT32 header_size,
+				 void *buf, UINT32 size);
 
 #endif	/* _TCP_H_ */
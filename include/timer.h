@@ -45,8 +45,12 @@ enum TM_POINT {
 	TM_POINT_LAST
 };
 
+uint64_t get_tsc_khz(void);
 uint32_t get_cpu_freq(void);
 uint32_t boottime_in_msec(void);
+uint64_t boottime_in_usec(void);
+uint64_t get_tsc(void);
+uint64_t tsc_to_usec(uint64_t ticks);
 void set_boottime_stamp(int num);
 void set_efi_enter_point(unsigned int value);
 void construct_stages_boottime(CHAR8 *time_str, size_t buf_len);
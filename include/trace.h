@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2022, Intel Corporation
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <efi.h>
+
+/* Boot time tracer.  Spans are recorded with their TSC timestamps in
+   a ring buffer of TRACE_ENTRIES entries: the oldest ones are
+   overwritten once it is full.  Spans may be nested, trace_end()
+   closes the innermost open span.  NAME must be a static string
+   without any space, comma or colon so that it can be passed on the
+   kernel command line. */
+
+struct trace_span {
+	const char *name;
+	UINT64 begin;		/* TSC */
+	UINT64 end;		/* TSC, 0 if the span is still open */
+	UINT32 depth;
+};
+
+void trace_begin(const char *name);
+void trace_end(void);
+
+UINTN trace_count(void);
+const struct trace_span *trace_get(UINTN index);
+
+/* Formats the completed spans as "NAME:START+DURATION,..." in
+   microseconds, oldest first.  The spans which do not fit in SIZE
+   are left out.  Returns the length of the string. */
+UINTN trace_format(CHAR8 *buf, UINTN size);
+
+#endif	/* _TRACE_H_ */
@@ -40,6 +40,27 @@
 typedef void (*data_callback_t)(void *buf, unsigned len);
 typedef void (*start_callback_t)(void);
 
+/* Completion latency histogram buckets: < 100us, < 1ms, < 10ms,
+   < 100ms, < 1s and above. */
+#define TRANSPORT_LATENCY_BUCKETS 6
+
+struct transport_dir_stats {
+	UINT64 bytes;
+	UINT64 transfers;
+	UINT64 busy_usec;	/* Time with at least one request pending */
+	UINT64 latency[TRANSPORT_LATENCY_BUCKETS];
+	/* Internal */
+	UINTN pending;
+	UINT64 start;
+};
+
+struct transport_stats {
+	struct transport_dir_stats rx;
+	struct transport_dir_stats tx;
+	UINT64 stall_usec;	/* Time the transport waited for the storage */
+	UINT64 stall_start;
+};
+
 typedef struct transport {
 	const char *name;
 	EFI_STATUS (*start)(start_callback_t start_cb,
@@ -49,6 +70,7 @@ typedef struct transport {
 	EFI_STATUS (*run)(void);
 	EFI_STATUS (*read)(void *buf, UINT32 size);
 	EFI_STATUS (*write)(void *buf, UINT32 size);
+	struct transport_stats stats;
 } transport_t;
 
 EFI_STATUS transport_register(transport_t *trans, UINTN nb);
@@ -62,4 +84,13 @@ EFI_STATUS transport_run(void);
 EFI_STATUS transport_read(void *buf, UINT32 len);
 EFI_STATUS transport_write(void *buf, UINT32 len);
 
+/* Account the time spent writing the storage while the transport is
+   idle or its completions are not serviced. */
+void transport_stall_begin(void);
+void transport_stall_end(void);
+
+const char *transport_get_name(void);
+struct transport_stats *transport_get_stats(void);
+void transport_reset_stats(void);
+
 #endif	/* _TRANSPORT_H_ */
@@ -41,8 +41,6 @@
 #include "protocol.h"
 #include "flash.h"
 #include "gpt.h"
-#include "sparse.h"
-#include "sparse_format.h"
 #include "fastboot.h"
 #include "fastboot_oem.h"
 #include "text_parser.h"
@@ -197,394 +195,62 @@ static EFI_STATUS read_file(EFI_FILE *file, UINTN size, void *data)
 	return ret;
 }
 
-typedef struct flash_buffer {
-	struct sparse_header sph;
-	struct chunk_header skip_ckh;
-	union {
-		struct chunk_header ckh;
-		char data[1];
-	} d;
-	char ckh_data[1];
-} __attribute__((__packed__)) flash_buffer_t;
-
-/*when flash big chunks and in two image should add read_flags*/
-static EFI_STATUS installer_flash_big_chunk_multiple(EFI_FILE **file, UINTN *read_flags,
-	UINTN file_size, UINTN *remaining_data, flash_buffer_t *fb, UINTN argc, CHAR8 **argv)
-{
-	EFI_STATUS ret = EFI_INVALID_PARAMETER;
-	UINTN payload_size, read_size, already_read, ckh_blks, data_size;
-	const UINTN MAX_DATA_SIZE = dl->max_size - offsetof(flash_buffer_t, ckh_data);
-	if (fb->sph.blk_sz == 0) {
-		return EFI_INVALID_PARAMETER;
-	}
-	const UINTN MAX_BLKS = MAX_DATA_SIZE / fb->sph.blk_sz;
-	const UINTN HEADER_SIZE = offsetof(flash_buffer_t, d);
-	struct chunk_header *ckh;
-	void *read_ptr;
-
-	ckh = &fb->d.ckh;
-	payload_size = ckh->total_sz - sizeof(*ckh);
-	fb->sph.total_chunks = 2; /* skip and data chunks. */
-
-	for (ckh_blks = ckh->chunk_sz; ckh_blks; ckh_blks -= ckh->chunk_sz) {
-		ckh->chunk_sz = min(MAX_BLKS, ckh_blks);
-		data_size = ((UINTN)ckh->chunk_sz) * fb->sph.blk_sz;
-		ckh->total_sz = sizeof(*ckh) + data_size;
-		fb->sph.total_blks = fb->skip_ckh.chunk_sz + ckh->chunk_sz;
-		installer_flash_buffer(fb, ckh->total_sz + HEADER_SIZE, argc, argv);
-		if (!last_cmd_succeeded)
-			return EFI_INVALID_PARAMETER;
-
-		payload_size -= data_size;
-		if (!payload_size)
-			break;
-
-		/* Move the incomplete data from the end to the
-		   beginning of the buffer. */
-		read_ptr = fb->ckh_data;
-		read_size = min(payload_size, MAX_DATA_SIZE);
-		if (data_size < MAX_DATA_SIZE) {
-			already_read = MAX_DATA_SIZE - data_size;
-			ret = memcpy_s(read_ptr, MAX_DATA_SIZE, fb->d.data + ckh->total_sz, already_read);
-			if (EFI_ERROR(ret))
-				return ret;
-			read_size -= already_read;
-			read_ptr += already_read;
-			if (read_size > file_size) {
-				ret = read_file(file[*read_flags], file_size, read_ptr);
-				if (EFI_ERROR(ret))
-					return ret;
-				read_size -= file_size;
-				read_ptr += file_size;
-				*remaining_data -= file_size;
-				(*read_flags)++;
-				}
-		}
-		ret = read_file(file[*read_flags], read_size, read_ptr);
-		if (EFI_ERROR(ret))
-			return ret;
-		*remaining_data -= read_size;
-
-		fb->skip_ckh.chunk_sz += ckh->chunk_sz;
-	}
-
-	if (payload_size)
-		return EFI_INVALID_PARAMETER;
-
-	return EFI_SUCCESS;
-}
-
-/* This function splits a chunk too large to fit into a
-   dl->max_size buffer into smaller chunks and flash them. */
-static EFI_STATUS installer_flash_big_chunk(EFI_FILE *file, UINTN *remaining_data,
-					    flash_buffer_t *fb, UINTN argc, CHAR8 **argv)
-{
-	EFI_STATUS ret = EFI_INVALID_PARAMETER;
-	UINTN payload_size, read_size, already_read, ckh_blks, data_size;
-	const UINTN MAX_DATA_SIZE = dl->max_size - offsetof(flash_buffer_t, ckh_data);
-	if (fb->sph.blk_sz == 0) {
-		return EFI_INVALID_PARAMETER;
-	}
-	const UINTN MAX_BLKS = MAX_DATA_SIZE / fb->sph.blk_sz;
-	const UINTN HEADER_SIZE = offsetof(flash_buffer_t, d);
-	struct chunk_header *ckh;
-	void *read_ptr;
-
-	ckh = &fb->d.ckh;
-	payload_size = ckh->total_sz - sizeof(*ckh);
-	fb->sph.total_chunks = 2; /* skip and data chunks. */
-
-	for (ckh_blks = ckh->chunk_sz; ckh_blks; ckh_blks -= ckh->chunk_sz) {
-		ckh->chunk_sz = min(MAX_BLKS, ckh_blks);
-		data_size = ((UINTN)ckh->chunk_sz) * fb->sph.blk_sz;
-		ckh->total_sz = sizeof(*ckh) + data_size;
-		fb->sph.total_blks = fb->skip_ckh.chunk_sz + ckh->chunk_sz;
-
-		installer_flash_buffer(fb, ckh->total_sz + HEADER_SIZE, argc, argv);
-		if (!last_cmd_succeeded)
-			return EFI_INVALID_PARAMETER;
-
-		payload_size -= data_size;
-		if (!payload_size)
-			break;
-
-		/* Move the incomplete data from the end to the
-		   beginning of the buffer. */
-		read_ptr = fb->ckh_data;
-		read_size = min(payload_size, MAX_DATA_SIZE);
-		if (data_size < MAX_DATA_SIZE) {
-			already_read = MAX_DATA_SIZE - data_size;
-			ret = memcpy_s(read_ptr, MAX_DATA_SIZE, fb->d.data + ckh->total_sz, already_read);
-			if (EFI_ERROR(ret))
-				return ret;
-			read_size -= already_read;
-			read_ptr += already_read;
-		}
-
-		ret = read_file(file, read_size, read_ptr);
-		if (EFI_ERROR(ret))
-			return ret;
-		*remaining_data -= read_size;
-
-		fb->skip_ckh.chunk_sz += ckh->chunk_sz;
-	}
-
-	if (payload_size)
-		return EFI_INVALID_PARAMETER;
-
-	return EFI_SUCCESS;
-}
-/*this function splits a huge sparse file and put together the two image*/
-static void installer_split_and_joint_flash(CHAR16 **filename,
-						UINTN *size, UINTN num, UINTN argc, CHAR8 **argv)
-{
-	EFI_STATUS ret;
-	flash_buffer_t *fb;
-	UINTN  read_flags = 0;
-	struct sparse_header sph;
-	struct chunk_header *ckh;
-	UINTN read_size, flash_size, already_read = 0, remaining_data = 0;
-	void *read_ptr;
-	INTN nb_chunks;
-	EFI_FILE *file[num];
-	UINT32 blk_count;
-
-	memset_s(file, sizeof(file), 0, sizeof(file));
-	const UINTN HEADER_SIZE = offsetof(flash_buffer_t, d);
-	const UINTN MAX_DATA_SIZE = dl->max_size - HEADER_SIZE;
-	for (UINTN i = 0; i < num; i++) {
-		remaining_data = remaining_data + size[i];
-		ret = uefi_open_file(file_io_interface, filename[i], &file[i]);
-		if (EFI_ERROR(ret)) {
-			inst_perror(ret, "Failed to open %s file", filename[i]);
-			return;
-		}
-	}
-
-	ret = read_file(file[0], sizeof(sph), &sph);
-	if (EFI_ERROR(ret))
-		return;
-	remaining_data -= sizeof(sph);
-	size[read_flags] -=  sizeof(sph);
-	if (!is_sparse_image((void *) &sph, sizeof(sph))) {
-		fastboot_fail("sparse file expected");
-		return;
-	}
-	fb = dl->data;
-	ret = memcpy_s(&fb->sph, sizeof(fb->sph), &sph, sizeof(sph));
-	if (EFI_ERROR(ret))
-		return;
-	/* Sparse skip chunk. */
-	fb->skip_ckh.chunk_type = CHUNK_TYPE_DONT_CARE;
-	fb->skip_ckh.total_sz = sizeof(fb->skip_ckh);
-	nb_chunks = sph.total_chunks;
-	read_size = MAX_DATA_SIZE;
-	read_ptr = fb->d.data;
-	blk_count = 0;
-	while (nb_chunks > 0 && remaining_data > 0) {
-		fb->sph.total_chunks = 1;
-		fb->sph.total_blks = fb->skip_ckh.chunk_sz = blk_count;
-		if (remaining_data < read_size)
-			read_size = remaining_data;
-		/* Read a new piece of the input sparse file. */
-		ret = read_file(file[read_flags], read_size, read_ptr);
-		if (EFI_ERROR(ret))
-			goto exit;
-		remaining_data -= read_size;
-		size[read_flags] -= read_size;
-		/* Process the loaded chunks to build the new header
-		   and the skip chunk. */
-		flash_size = HEADER_SIZE;
-		ckh = &fb->d.ckh;
-		while ((void *)ckh + sizeof(*ckh) <= read_ptr + read_size &&
-				(void *)ckh + ckh->total_sz <= read_ptr + read_size) {
-			if (nb_chunks == 0)
-				goto exit;
-			flash_size += ckh->total_sz;
-			fb->sph.total_blks += ckh->chunk_sz;
-			blk_count += ckh->chunk_sz;
-			fb->sph.total_chunks++;
-			nb_chunks--;
-			ckh = (void *)ckh + ckh->total_sz;
-		}
-		/* chunk is too big to fit in the download buffer. */
-		if (flash_size == HEADER_SIZE) {
-			if (ckh->chunk_type != CHUNK_TYPE_RAW ||
-					remaining_data < ckh->total_sz - MAX_DATA_SIZE) {
-				fastboot_fail("Corrupted sparse file");
-				goto exit;
-			}
-
-			blk_count += ckh->chunk_sz;
-			nb_chunks--;
-
-			ret = installer_flash_big_chunk_multiple(file, &read_flags,
-						size[read_flags], &remaining_data, fb, argc, argv);
-			if (EFI_ERROR(ret))
-				goto exit;
-
-			read_size = MAX_DATA_SIZE;
-			read_ptr = fb->d.data;
-			continue;
-		}
-
-		installer_flash_buffer(dl->data, flash_size, argc, argv);
-		if (!last_cmd_succeeded)
-			goto exit;
-		/* Move the incomplete chunk from the end to the
-		   beginning of the buffer. */
-
-		if (dl->data + flash_size < read_ptr + read_size) {
-			already_read = read_ptr + read_size - (void *)ckh;
-			ret = memcpy_s(fb->d.data, MAX_DATA_SIZE, ckh, already_read);
-			if (EFI_ERROR(ret))
-				goto exit;
-			read_size = MAX_DATA_SIZE - already_read;
-			read_ptr = fb->d.data + already_read;
-
-		} else {
-			read_size = MAX_DATA_SIZE;
-			read_ptr = fb->d.data;
-		}
-		if ((read_size > size[read_flags]) && (read_flags != (num - 1))) {
-			ret = read_file(file[read_flags], size[read_flags], read_ptr);
-			if (EFI_ERROR(ret))
-				goto exit;
-			ret = memcpy_s(fb->d.data+already_read, MAX_DATA_SIZE, read_ptr, size[read_flags]);
-			if (EFI_ERROR(ret))
-				goto exit;
-			read_size = read_size - size[read_flags];
-			remaining_data  -= size[read_flags];
-			read_ptr = fb->d.data+already_read+size[read_flags];
-			read_flags++;
-			}
-	}
-exit:
-	for (UINTN i = 0; i < num; i++)
-		uefi_call_wrapper(file[i]->Close, 1, file[i]);
-}
-/* This function splits a huge sparse file into smaller ones and flash
-   them. */
-static void installer_split_and_flash(CHAR16 *filename, UINTN size,
-				      UINTN argc, CHAR8 **argv)
+/* Stream the concatenation of the NUM files into the partition
+   ARGV[1] through the download buffer.  Sparse images are decoded on
+   the fly so the memory footprint does not depend on the chunk sizes.
+   The flash command then commits the data, as for a streamed
+   download, and reports the outcome. */
+static void installer_stream_flash(CHAR16 **filename, UINTN *size,
+				   UINTN num, INTN argc, CHAR8 **argv)
 {
 	EFI_STATUS ret;
-	flash_buffer_t *fb;
-	struct sparse_header sph;
-	struct chunk_header *ckh;
-	UINTN read_size, flash_size, already_read, remaining_data = size;
-	void *read_ptr;
-	INTN nb_chunks;
 	EFI_FILE *file;
-	UINT32 blk_count;
-	const UINTN HEADER_SIZE = offsetof(flash_buffer_t, d);
-	const UINTN MAX_DATA_SIZE = dl->max_size - HEADER_SIZE;
+	UINTN i, remaining_data, read_size, used = 0;
 
-	ret = uefi_open_file(file_io_interface, filename, &file);
+	ret = fastboot_stream_open(argv[1]);
 	if (EFI_ERROR(ret)) {
-		inst_perror(ret, "Failed to open %s file", filename);
+		inst_perror(ret, "Cannot flash %a by pieces", argv[1]);
 		return;
 	}
 
-	ret = read_file(file, sizeof(sph), &sph);
-	if (EFI_ERROR(ret))
-		return;
-	remaining_data -= sizeof(sph);
-
-	if (!is_sparse_image((void *) &sph, sizeof(sph))) {
-		fastboot_fail("sparse file expected");
-		return;
-	}
-
-	fb = dl->data;
-
-	/* New sparse header. */
-	ret = memcpy_s(&fb->sph, sizeof(fb->sph), &sph, sizeof(sph));
-	if (EFI_ERROR(ret))
-		return;
-
-	/* Sparse skip chunk. */
-	fb->skip_ckh.chunk_type = CHUNK_TYPE_DONT_CARE;
-	fb->skip_ckh.total_sz = sizeof(fb->skip_ckh);
-
-	nb_chunks = sph.total_chunks;
-	read_size = MAX_DATA_SIZE;
-	read_ptr = fb->d.data;
-	blk_count = 0;
-
-	while (nb_chunks > 0 && remaining_data > 0) {
-		fb->sph.total_chunks = 1;
-		fb->sph.total_blks = fb->skip_ckh.chunk_sz = blk_count;
-
-		if (remaining_data < read_size)
-			read_size = remaining_data;
-
-		/* Read a new piece of the input sparse file. */
-		ret = read_file(file, read_size, read_ptr);
-		if (EFI_ERROR(ret))
-			goto exit;
-		remaining_data -= read_size;
-
-		/* Process the loaded chunks to build the new header
-		   and the skip chunk. */
-		flash_size = HEADER_SIZE;
-		ckh = &fb->d.ckh;
-		while ((void *)ckh + sizeof(*ckh) <= read_ptr + read_size &&
-				(void *)ckh + ckh->total_sz <= read_ptr + read_size) {
-			if (nb_chunks == 0) {
-				fastboot_fail("Corrupted sparse file: too many chunks");
-				goto exit;
-			}
-			flash_size += ckh->total_sz;
-			fb->sph.total_blks += ckh->chunk_sz;
-			blk_count += ckh->chunk_sz;
-			fb->sph.total_chunks++;
-			nb_chunks--;
-			ckh = (void *)ckh + ckh->total_sz;
+	for (i = 0; i < num && !EFI_ERROR(ret); i++) {
+		ret = uefi_open_file(file_io_interface, filename[i], &file);
+		if (EFI_ERROR(ret)) {
+			inst_perror(ret, "Failed to open %s file", filename[i]);
+			goto abort;
 		}
 
-		/* chunk is too big to fit in the download buffer. */
-		if (flash_size == HEADER_SIZE) {
-			if (ckh->chunk_type != CHUNK_TYPE_RAW ||
-					remaining_data < ckh->total_sz - MAX_DATA_SIZE) {
-				fastboot_fail("Corrupted sparse file");
-				goto exit;
+		for (remaining_data = size[i]; remaining_data && !EFI_ERROR(ret);
+		     remaining_data -= read_size) {
+			read_size = min(remaining_data, dl->max_size - used);
+			ret = read_file(file, read_size, dl->data + used);
+			if (EFI_ERROR(ret)) {
+				uefi_call_wrapper(file->Close, 1, file);
+				goto abort;
 			}
 
-			blk_count += ckh->chunk_sz;
-			nb_chunks--;
-
-			ret = installer_flash_big_chunk(file, &remaining_data,
-					fb, argc, argv);
-			if (EFI_ERROR(ret))
-				goto exit;
-
-			read_size = MAX_DATA_SIZE;
-			read_ptr = fb->d.data;
-			continue;
+			used += read_size;
+			if (used == dl->max_size) {
+				ret = fastboot_stream_write(dl->data, used);
+				used = 0;
+			}
 		}
 
-		installer_flash_buffer(dl->data, flash_size, argc, argv);
-		if (!last_cmd_succeeded)
-			goto exit;
-
-		/* Move the incomplete chunk from the end to the
-		   beginning of the buffer. */
-		if (dl->data + flash_size < read_ptr + read_size) {
-			already_read = read_ptr + read_size - (void *)ckh;
-			ret = memcpy_s(fb->d.data, MAX_DATA_SIZE, ckh, already_read);
-			if (EFI_ERROR(ret))
-				goto exit;
-			read_size = MAX_DATA_SIZE - already_read;
-			read_ptr = fb->d.data + already_read;
-		} else {
-			read_size = MAX_DATA_SIZE;
-			read_ptr = fb->d.data;
-		}
+		uefi_call_wrapper(file->Close, 1, file);
 	}
 
-exit:
-	uefi_call_wrapper(file->Close, 1, file);
+	/* Write errors are reported by the flash command. */
+	if (!EFI_ERROR(ret) && used)
+		fastboot_stream_write(dl->data, used);
+	fastboot_stream_close();
+
+	fastboot_flash_cmd(argc, argv);
+	flush_tx_buffer();
+	return;
+
+abort:
+	/* The command has already failed, drop the stream. */
+	fastboot_stream_abort();
 }
 
 static void installer_flash_cmd(INTN argc, CHAR8 **argv)
@@ -643,7 +309,7 @@ static void installer_flash_cmd(INTN argc, CHAR8 **argv)
 			goto exit;
 		}
 
-		installer_split_and_joint_flash(numname, numsize, num, argc, argv);
+		installer_stream_flash(numname, numsize, num, argc, argv);
 	} else {
 		/* The fastboot flash command does not want the file parameter. */
 		argc--;
@@ -685,7 +351,7 @@ static void installer_flash_cmd(INTN argc, CHAR8 **argv)
 		}
 
 		if (size > dl->max_size) {
-			installer_split_and_flash(filename, size, argc, argv);
+			installer_stream_flash(&filename, &size, 1, argc, argv);
 			goto exit;
 		}
 
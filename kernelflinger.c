@@ -55,6 +55,7 @@
 #include "storage.h"
 #include "version.h"
 #include "timer.h"
+#include "trace.h"
 #ifdef HAL_AUTODETECT
 #include "blobstore.h"
 #endif
@@ -916,7 +917,9 @@ static EFI_STATUS load_image(VOID *bootimage, VOID *vendorbootimage, UINT8 boot_
 #endif
 
 	/* install acpi tables before starting trusty */
+	trace_begin("acpi-install");
 	ret = setup_acpi_table(bootimage, boot_target);
+	trace_end();
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"setup_acpi_table");
 		return ret;
@@ -934,7 +937,9 @@ static EFI_STATUS load_image(VOID *bootimage, VOID *vendorbootimage, UINT8 boot_
 #endif
 		}
 		debug(L"loading trusty");
+		trace_begin("trusty-load");
 		ret = load_tos_image(&tosimage);
+		trace_end();
 		if (EFI_ERROR(ret)) {
 			efi_perror(ret, L"Load tos image failed");
 			die();
@@ -953,7 +958,9 @@ static EFI_STATUS load_image(VOID *bootimage, VOID *vendorbootimage, UINT8 boot_
                 }
 
 		set_boottime_stamp(TM_LOAD_TOS_DONE);
+		trace_begin("trusty-start");
 		ret = start_trusty(tosimage);
+		trace_end();
 		if (EFI_ERROR(ret)) {
 			efi_perror(ret, L"Unable to start trusty; stop.");
 			die();
@@ -1356,8 +1363,10 @@ EFI_STATUS efi_main(EFI_HANDLE image, EFI_SYSTEM_TABLE *sys_table)
 
 	/* AVB check */
 	disable_slot_if_efi_loaded_slot_failed();
+	trace_begin("avb-verify");
 	ret = avb_load_verify_boot_image(boot_target, target_path, &bootimage, oneshot, &boot_state, &vb_data);
 	avb_load_verify_vendor_boot_image(boot_target, &vendorbootimage);
+	trace_end();
 
 	set_boottime_stamp(TM_VERIFY_BOOT_DONE);
 
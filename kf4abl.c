@@ -606,12 +606,13 @@ static enum boot_target check_command_line(EFI_HANDLE image, CHAR8 *cmd_buf, UIN
 				/* Parse "fw_boottsc=xxxxx" */
 				case FIRMWARE_BOOTTIME: {
 					UINT64 VALUE;
-					UINT32 cpu_khz;
+					UINT64 cpu_khz;
 					nptr = (CHAR8 *)(arg8 + CmdlineArray[j].length);
 					VALUE = (UINT64)strtoull((char *)nptr, 0, 10);
-					cpu_khz = get_cpu_freq() * 1000;
+					cpu_khz = get_tsc_khz();
 					//EFI_ENTER_POINT boot time is recorded in ms
-					set_efi_enter_point(VALUE /cpu_khz);
+					if (cpu_khz)
+						set_efi_enter_point(VALUE / cpu_khz);
 					continue;
 				}
 
@@ -12,6 +12,7 @@ LOCAL_STATIC_LIBRARIES := \
 LOCAL_EXPORT_C_INCLUDE_DIRS := $(LOCAL_PATH)/../include/libefitcp
 LOCAL_C_INCLUDES := $(LOCAL_PATH)/../include/libefitcp
 LOCAL_SRC_FILES := \
-	tcp.c
+	tcp.c \
+	udp.c
 
 include $(BUILD_EFI_STATIC_LIBRARY)
@@ -53,18 +53,37 @@ static EFI_TCP4_CLOSE_TOKEN close_token;
 #define MAX_TOKEN 16
 #define RX_FRAG_SIZE 2048  /* Fragment size greater or equal to TCP
 			      MSS  */
+
+/* Number of receive tokens kept queued while reading.  Each in place
+   token requests up to RX_TOKEN_MAX bytes, this bounds the receive
+   window we expose to the TCP stack.  */
+#ifndef TCP_RX_TOKENS
+#define TCP_RX_TOKENS 32
+#endif
+#define RX_TOKEN_MIN 1024
+#define RX_TOKEN_MAX (64 * 1024)
+#define TX_HEADER_SIZE 16
 typedef struct token {
 	EFI_TCP4_IO_TOKEN token;
 	UINT32 requested;
+	CHAR8 header[TX_HEADER_SIZE];
 } token_t;
-static token_t rx_token[MAX_TOKEN];
-static EFI_TCP4_RECEIVE_DATA rx_data[MAX_TOKEN];
-static CHAR8 rx_frag_buf[MAX_TOKEN][RX_FRAG_SIZE];
+static token_t rx_token[TCP_RX_TOKENS];
+static EFI_TCP4_RECEIVE_DATA rx_data[TCP_RX_TOKENS];
+/* Receive tokens point directly into the caller buffer.  These
+   fragments are only used once the end of the caller buffer is
+   already covered by pending tokens, see request_data().  */
+static CHAR8 rx_frag_buf[TCP_RX_TOKENS][RX_FRAG_SIZE];
 
 /* TX data structures  */
 static UINTN next_tx_token;
 static token_t tx_token[MAX_TOKEN];
-static EFI_TCP4_TRANSMIT_DATA tx_data[MAX_TOKEN];
+/* EFI_TCP4_TRANSMIT_DATA only declares one fragment, reserve the
+   room for a second one right after it for the header.  */
+static struct {
+	EFI_TCP4_TRANSMIT_DATA data;
+	EFI_TCP4_FRAGMENT_DATA payload;
+} tx_data[MAX_TOKEN];
 
 /* Events  */
 static BOOLEAN events_created;
@@ -79,15 +98,38 @@ static struct rx {
 	UINT32 size;
 	UINT32 requested;
 	UINT32 received;
+	UINT32 offset;
+	UINT32 token_size;
 	BOOLEAN receiving;
 } rx;
 
+/* Receive tokens complete in the order they have been queued.  A
+   token normally receives its data in place, at the offset of the
+   caller buffer it has been given.  A token may complete with less
+   data than requested though: the data of the following tokens is
+   then moved back to close the gap.  Once the end of the caller
+   buffer is assigned, the remaining requests go through the token
+   fragment buffer and are copied on completion.
+
+   The TCP stack completes a token with the data it has at hand, so
+   the in place request size follows the size of the last completion
+   to keep the gaps small: it doubles while tokens are filled and
+   drops to the received length otherwise.  */
 static EFI_STATUS request_data(token_t *token, UINT32 max_size)
 {
 	EFI_STATUS ret;
-	UINTN size = min(max_size, (UINT32)RX_FRAG_SIZE);
+	UINT32 size;
 	EFI_TCP4_RECEIVE_DATA *data = token->token.Packet.RxData;
 
+	if (rx.offset < rx.size) {
+		size = min(min(max_size, rx.token_size), rx.size - rx.offset);
+		data->FragmentTable[0].FragmentBuffer = rx.buf + rx.offset;
+		rx.offset += size;
+	} else {
+		size = min(max_size, (UINT32)RX_FRAG_SIZE);
+		data->FragmentTable[0].FragmentBuffer = rx_frag_buf[token - rx_token];
+	}
+
 	data->DataLength = size;
 	data->FragmentTable[0].FragmentLength = size;
 
@@ -121,8 +163,8 @@ static void EFIAPI data_sent(__attribute__((__unused__)) EFI_EVENT evt,
 	}
 
 	token->requested = 0;
-	tx_callback(data->FragmentTable[0].FragmentBuffer,
-		    data->FragmentTable[0].FragmentLength);
+	tx_callback(data->FragmentTable[data->FragmentCount - 1].FragmentBuffer,
+		    data->FragmentTable[data->FragmentCount - 1].FragmentLength);
 }
 
 static void EFIAPI data_received(__attribute__((__unused__)) EFI_EVENT evt, void *ctx)
@@ -130,6 +172,8 @@ static void EFIAPI data_received(__attribute__((__unused__)) EFI_EVENT evt, void
 	EFI_STATUS ret;
 	token_t *token = (token_t *)ctx;
 	EFI_TCP4_RECEIVE_DATA *data = token->token.Packet.RxData;
+	char *dst;
+	UINT32 len;
 
 	if (token->token.CompletionToken.Status == EFI_CONNECTION_FIN) {
 		rx.receiving = FALSE;
@@ -155,17 +199,26 @@ static void EFIAPI data_received(__attribute__((__unused__)) EFI_EVENT evt, void
 		return;
 	}
 
-	ret = memcpy_s(rx.buf + rx.received, rx.size,
-				   data->FragmentTable[0].FragmentBuffer,
-				   data->FragmentTable[0].FragmentLength);
-	if (EFI_ERROR(ret)) {
+	dst = rx.buf + rx.received;
+	len = data->FragmentTable[0].FragmentLength;
+	if (len > rx.size - rx.received) {
 		rx.receiving = FALSE;
 		return;
 	}
 
-	rx.received += data->FragmentTable[0].FragmentLength;
+	/* Source and destination overlap when a previous token came
+	   back short, CopyMem() handles it.  */
+	if (data->FragmentTable[0].FragmentBuffer != dst)
+		CopyMem(dst, data->FragmentTable[0].FragmentBuffer, len);
+
+	rx.received += len;
 	rx.requested -= token->requested;
 
+	if (len == token->requested)
+		rx.token_size = min(rx.token_size * 2, (UINT32)RX_TOKEN_MAX);
+	else
+		rx.token_size = max(len, (UINT32)RX_TOKEN_MIN);
+
 	if (rx.requested < rx.size - rx.received)
 		request_data(token, rx.size - rx.received - rx.requested);
 
@@ -228,16 +281,18 @@ static void init_rx_tx_structures()
 {
 	UINTN i;
 
-	for (i = 0; i < MAX_TOKEN; i++) {
+	for (i = 0; i < TCP_RX_TOKENS; i++) {
 		rx_data[i].UrgentFlag = FALSE;
 		rx_data[i].FragmentCount = 1;
 		rx_data[i].FragmentTable[0].FragmentBuffer = rx_frag_buf[i];
 		rx_token[i].token.Packet.RxData = &rx_data[i];
+	}
 
-		tx_data[i].Push = TRUE;
-		tx_data[i].Urgent = FALSE;
-		tx_data[i].FragmentCount = 1;
-		tx_token[i].token.Packet.TxData = &tx_data[i];
+	for (i = 0; i < MAX_TOKEN; i++) {
+		tx_data[i].data.Push = TRUE;
+		tx_data[i].data.Urgent = FALSE;
+		tx_data[i].data.FragmentCount = 1;
+		tx_token[i].token.Packet.TxData = &tx_data[i].data;
 	}
 }
 
@@ -281,7 +336,7 @@ static EFI_STATUS create_events()
 		}
 	}
 
-	for (j = 0; j < MAX_TOKEN; j++) {
+	for (j = 0; j < TCP_RX_TOKENS; j++) {
 		ret = uefi_call_wrapper(BS->CreateEvent, 5,
 					EVT_NOTIFY_SIGNAL,
 					TPL_CALLBACK,
@@ -335,7 +390,7 @@ void close_events()
 			efi_perror(ret, L"Failed to close TCP Transmit %d event", i);
 	}
 
-	for (i = 0; i < MAX_TOKEN; i++) {
+	for (i = 0; i < TCP_RX_TOKENS; i++) {
 		ret = uefi_call_wrapper(BS->CloseEvent, 1,
 					rx_token[i].token.CompletionToken.Event);
 		if (EFI_ERROR(ret))
@@ -486,11 +541,16 @@ err:
 	return ret;
 }
 
-EFI_STATUS tcp_write(void *buf, UINT32 size)
+EFI_STATUS tcp_write_with_header(void *header, UINT32 header_size,
+				 void *buf, UINT32 size)
 {
 	EFI_STATUS ret;
 	token_t *token;
 	EFI_TCP4_TRANSMIT_DATA *data;
+	EFI_TCP4_FRAGMENT_DATA *frag;
+
+	if (header_size > sizeof(token->header))
+		return EFI_INVALID_PARAMETER;
 
 	if (tx_token[next_tx_token].requested != 0)
 		return EFI_NOT_READY;
@@ -498,11 +558,28 @@ EFI_STATUS tcp_write(void *buf, UINT32 size)
 	token = &tx_token[next_tx_token];
 	next_tx_token = (next_tx_token + 1) % MAX_TOKEN;
 	data = token->token.Packet.TxData;
+	frag = data->FragmentTable;
+
+	/* The header is copied in the token so that the caller does
+	   not have to keep it until the transmission completes.  The
+	   payload is sent in place.  */
+	data->FragmentCount = 0;
+	if (header_size) {
+		ret = memcpy_s(token->header, sizeof(token->header),
+			       header, header_size);
+		if (EFI_ERROR(ret))
+			return ret;
+		frag->FragmentLength = header_size;
+		frag->FragmentBuffer = token->header;
+		frag++;
+		data->FragmentCount++;
+	}
+	frag->FragmentLength = size;
+	frag->FragmentBuffer = buf;
+	data->FragmentCount++;
 
-	token->requested = size;
-	data->DataLength = size;
-	data->FragmentTable[0].FragmentLength = size;
-	data->FragmentTable[0].FragmentBuffer = buf;
+	token->requested = header_size + size;
+	data->DataLength = header_size + size;
 
 	ret = uefi_call_wrapper(tcp_connection->Transmit, 2,
 				tcp_connection, &token->token);
@@ -512,6 +589,11 @@ EFI_STATUS tcp_write(void *buf, UINT32 size)
 	return ret;
 }
 
+EFI_STATUS tcp_write(void *buf, UINT32 size)
+{
+	return tcp_write_with_header(NULL, 0, buf, size);
+}
+
 EFI_STATUS tcp_read(void *buf, UINT32 size)
 {
 	EFI_STATUS ret;
@@ -522,10 +604,11 @@ EFI_STATUS tcp_read(void *buf, UINT32 size)
 
 	rx.buf = buf;
 	rx.size = size;
-	rx.received = rx.requested = 0;
+	rx.received = rx.requested = rx.offset = 0;
+	rx.token_size = RX_FRAG_SIZE;
 	rx.receiving = TRUE;
 
-	for (i = 0; i < MAX_TOKEN && size; i++) {
+	for (i = 0; i < TCP_RX_TOKENS && size; i++) {
 		ret = request_data(&rx_token[i], size);
 		if (EFI_ERROR(ret)) {
 			rx.receiving = FALSE;
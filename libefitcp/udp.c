@@ -0,0 +1,405 @@
+/*
+ * Copyright (c) 2022, Intel Corporation
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <lib.h>
+#include <uefi_utils.h>
+#include <efiudp.h>
+
+#include "udp.h"
+
+/* UDP/IP structures  */
+static EFI_HANDLE udp_handle;
+static EFI_GUID UDP_GUID = EFI_UDP4_PROTOCOL;
+static EFI_SERVICE_BINDING *udp_srv_binding;
+static EFI_UDP4 *udp;
+
+/* RX data structures  */
+static EFI_UDP4_COMPLETION_TOKEN rx_token;
+static CHAR8 rx_buf[UDP_MAX_DATAGRAM];
+
+/* Datagrams are sent back to the sender of the last received one.  */
+static EFI_UDP4_SESSION_DATA peer;
+static BOOLEAN peer_known;
+
+/* TX data structures  */
+#define MAX_TOKEN 8
+typedef struct token {
+	EFI_UDP4_COMPLETION_TOKEN token;
+	EFI_UDP4_TRANSMIT_DATA data;
+	EFI_UDP4_SESSION_DATA session;
+	BOOLEAN busy;
+	CHAR8 buf[UDP_MAX_DATAGRAM];
+} token_t;
+static UINTN next_tx_token;
+static token_t tx_token[MAX_TOKEN];
+
+/* Events  */
+static BOOLEAN events_created;
+
+/* Caller data  */
+static datagram_callback_t rx_callback;
+
+static EFI_STATUS request_data(void)
+{
+	EFI_STATUS ret;
+
+	rx_token.Packet.RxData = NULL;
+	ret = uefi_call_wrapper(udp->Receive, 2, udp, &rx_token);
+	if (EFI_ERROR(ret))
+		efi_perror(ret, L"UDP Receive failed");
+
+	return ret;
+}
+
+/* Event handlers */
+static void EFIAPI data_sent(__attribute__((__unused__)) EFI_EVENT evt,
+			     void *ctx)
+{
+	token_t *token = (token_t *)ctx;
+
+	if (EFI_ERROR(token->token.Status))
+		efi_perror(token->token.Status, L"UDP Transmit failed");
+
+	token->busy = FALSE;
+}
+
+static void EFIAPI data_received(__attribute__((__unused__)) EFI_EVENT evt,
+				 __attribute__((__unused__)) void *ctx)
+{
+	EFI_STATUS ret;
+	EFI_UDP4_RECEIVE_DATA *data = rx_token.Packet.RxData;
+	UINT32 i, size = 0;
+	BOOLEAN valid;
+
+	if (rx_token.Status == EFI_ABORTED)
+		return;
+
+	if (EFI_ERROR(rx_token.Status) || !data) {
+		efi_perror(rx_token.Status, L"UDP Receive with bad status");
+		request_data();
+		return;
+	}
+
+	valid = data->DataLength <= sizeof(rx_buf);
+	for (i = 0; valid && i < data->FragmentCount; i++) {
+		ret = memcpy_s(rx_buf + size, sizeof(rx_buf) - size,
+			       data->FragmentTable[i].FragmentBuffer,
+			       data->FragmentTable[i].FragmentLength);
+		if (EFI_ERROR(ret))
+			valid = FALSE;
+		size += data->FragmentTable[i].FragmentLength;
+	}
+
+	if (valid) {
+		peer.DestinationAddress = data->UdpSession.SourceAddress;
+		peer.DestinationPort = data->UdpSession.SourcePort;
+		peer_known = TRUE;
+	} else
+		debug(L"Dropping a %d bytes datagram", data->DataLength);
+
+	uefi_call_wrapper(BS->SignalEvent, 1, data->RecycleSignal);
+	request_data();
+
+	if (valid)
+		rx_callback(rx_buf, size);
+}
+
+static EFI_STATUS create_events(void)
+{
+	EFI_STATUS ret;
+	UINTN i, k;
+
+	ret = uefi_call_wrapper(BS->CreateEvent, 5,
+				EVT_NOTIFY_SIGNAL,
+				TPL_CALLBACK,
+				data_received,
+				NULL,
+				&rx_token.Event);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to create UDP Receive event");
+		return ret;
+	}
+
+	for (i = 0; i < MAX_TOKEN; i++) {
+		ret = uefi_call_wrapper(BS->CreateEvent, 5,
+					EVT_NOTIFY_SIGNAL,
+					TPL_CALLBACK,
+					data_sent,
+					&tx_token[i],
+					&tx_token[i].token.Event);
+		if (EFI_ERROR(ret)) {
+			efi_perror(ret, L"Failed to create UDP Transmit event");
+			goto err;
+		}
+	}
+
+	events_created = TRUE;
+	return EFI_SUCCESS;
+
+err:
+	uefi_call_wrapper(BS->CloseEvent, 1, rx_token.Event);
+	for (k = 0; k < i; k++)
+		uefi_call_wrapper(BS->CloseEvent, 1, tx_token[k].token.Event);
+	return ret;
+}
+
+static void close_events(void)
+{
+	EFI_STATUS ret;
+	UINTN i;
+
+	ret = uefi_call_wrapper(BS->CloseEvent, 1, rx_token.Event);
+	if (EFI_ERROR(ret))
+		efi_perror(ret, L"Failed to close UDP Receive event");
+
+	for (i = 0; i < MAX_TOKEN; i++) {
+		ret = uefi_call_wrapper(BS->CloseEvent, 1,
+					tx_token[i].token.Event);
+		if (EFI_ERROR(ret))
+			efi_perror(ret, L"Failed to close UDP Transmit %d event", i);
+	}
+
+	events_created = FALSE;
+}
+
+static EFI_STATUS ip_configuration(UINT32 port, EFI_IPv4_ADDRESS *address)
+{
+	EFI_STATUS ret;
+	EFI_IP4_MODE_DATA ip_data;
+	EFI_UDP4_CONFIG_DATA udp_config = {
+		.AcceptBroadcast = FALSE,
+		.AcceptPromiscuous = FALSE,
+		.AcceptAnyPort = FALSE,
+		.AllowDuplicatePort = FALSE,
+		.TypeOfService = 0x00,
+		.TimeToLive = 255,
+		.DoNotFragment = FALSE,
+		.ReceiveTimeout = 0,
+		.TransmitTimeout = 0,
+		.UseDefaultAddress = TRUE,
+		.StationAddress = { {0, 0, 0, 0} }, /* ignored - use default */
+		.SubnetMask = { {0, 0, 0, 0} },	    /* ignored - use default */
+		.StationPort = port,
+		.RemoteAddress = { {0, 0, 0, 0} }, /* accept any */
+		.RemotePort = 0 /* accept any */
+	};
+	memset_s((UINT8 *)&ip_data, sizeof(ip_data), 0, sizeof(ip_data));
+
+	ret = uefi_call_wrapper(udp->Configure, 2, udp, &udp_config);
+	if (EFI_ERROR(ret) && ret != EFI_NO_MAPPING) {
+		efi_perror(ret, L"Failed to configure IP stack");
+		return ret;
+	}
+
+	/* DHCP still ongoing. */
+	if (ret == EFI_NO_MAPPING) {
+		do {
+			ret = uefi_call_wrapper(udp->GetModeData, 5,
+						udp, NULL, &ip_data, NULL, NULL);
+			if (EFI_ERROR(ret)) {
+				efi_perror(ret, L"Failed to get IP mode data");
+				return ret;
+			}
+		} while (!ip_data.IsConfigured);
+		ret = uefi_call_wrapper(udp->Configure, 2, udp, &udp_config);
+		if (EFI_ERROR(ret)) {
+			efi_perror(ret, L"Failed to configure IP stack");
+			return ret;
+		}
+	}
+
+	if (!ip_data.IsConfigured) {
+		ret = uefi_call_wrapper(udp->GetModeData, 5,
+					udp, NULL, &ip_data, NULL, NULL);
+		if (EFI_ERROR(ret)) {
+			efi_perror(ret, L"Failed to get IP mode data");
+			return ret;
+		}
+	}
+
+	return memcpy_s(address, sizeof(*address),
+			&ip_data.ConfigData.StationAddress, sizeof(*address));
+}
+
+EFI_STATUS udp_start(UINT32 port, datagram_callback_t rx_cb,
+		     EFI_IPv4_ADDRESS *station_address)
+{
+	EFI_GUID udp_srv_binding_guid = EFI_UDP4_SERVICE_BINDING_PROTOCOL;
+	EFI_HANDLE *handles;
+	UINTN nb_handle = 0, i;
+	EFI_STATUS ret;
+
+	if (!rx_cb || !station_address)
+		return EFI_INVALID_PARAMETER;
+
+	rx_callback = rx_cb;
+	peer_known = FALSE;
+
+	ret = uefi_call_wrapper(BS->LocateHandleBuffer, 5, ByProtocol,
+				&udp_srv_binding_guid, NULL, &nb_handle, &handles);
+	if (EFI_ERROR(ret)) {
+		debug(L"Failed to locate UDP service binding protocol");
+		return EFI_UNSUPPORTED;
+	}
+
+	/* Use the first network device. */
+	ret = uefi_call_wrapper(BS->OpenProtocol, 6,
+				handles[0],
+				&udp_srv_binding_guid,
+				(VOID **)&udp_srv_binding,
+				g_parent_image,
+				NULL,
+				EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+	FreePool(handles);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to open UDP service binding protocol");
+		return ret;
+	}
+
+	ret = uefi_call_wrapper(udp_srv_binding->CreateChild, 2,
+				udp_srv_binding, &udp_handle);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to create UDP child");
+		return ret;
+	}
+
+	ret = uefi_call_wrapper(BS->OpenProtocol, 6,
+				udp_handle,
+				&UDP_GUID,
+				(VOID **)&udp,
+				g_parent_image,
+				NULL,
+				EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to open UDP protocol");
+		goto err;
+	}
+
+	for (i = 0; i < MAX_TOKEN; i++) {
+		tx_token[i].busy = FALSE;
+		tx_token[i].data.UdpSessionData = &tx_token[i].session;
+		tx_token[i].data.GatewayAddress = NULL;
+		tx_token[i].data.FragmentCount = 1;
+		tx_token[i].data.FragmentTable[0].FragmentBuffer = tx_token[i].buf;
+		tx_token[i].token.Packet.TxData = &tx_token[i].data;
+	}
+
+	ret = create_events();
+	if (EFI_ERROR(ret))
+		goto err;
+
+	ret = ip_configuration(port, station_address);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"IP configuration failed");
+		goto err;
+	}
+
+	ret = request_data();
+	if (EFI_ERROR(ret))
+		goto err;
+
+	return EFI_SUCCESS;
+
+err:
+	udp_stop();
+	return ret;
+}
+
+EFI_STATUS udp_send(void *buf, UINT32 size)
+{
+	EFI_STATUS ret;
+	token_t *token;
+
+	if (!peer_known)
+		return EFI_NOT_READY;
+
+	token = &tx_token[next_tx_token];
+	if (token->busy)
+		return EFI_NOT_READY;
+	next_tx_token = (next_tx_token + 1) % MAX_TOKEN;
+
+	/* The caller is free to reuse its buffer right away.  */
+	ret = memcpy_s(token->buf, sizeof(token->buf), buf, size);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	memset_s(&token->session, sizeof(token->session), 0,
+		 sizeof(token->session));
+	token->session.DestinationAddress = peer.DestinationAddress;
+	token->session.DestinationPort = peer.DestinationPort;
+	token->data.DataLength = size;
+	token->data.FragmentTable[0].FragmentLength = size;
+	token->busy = TRUE;
+
+	ret = uefi_call_wrapper(udp->Transmit, 2, udp, &token->token);
+	if (EFI_ERROR(ret)) {
+		token->busy = FALSE;
+		efi_perror(ret, L"UDP Transmit failed");
+	}
+
+	return ret;
+}
+
+EFI_STATUS udp_stop(void)
+{
+	EFI_STATUS ret;
+
+	if (udp) {
+		/* Aborts all the pending tokens.  */
+		ret = uefi_call_wrapper(udp->Configure, 2, udp, NULL);
+		if (EFI_ERROR(ret)) {
+			efi_perror(ret, L"UDP Configure failed");
+			return ret;
+		}
+		udp = NULL;
+	}
+
+	if (events_created)
+		close_events();
+
+	if (udp_srv_binding) {
+		ret = uefi_call_wrapper(udp_srv_binding->DestroyChild, 2,
+					udp_srv_binding, udp_handle);
+		if (EFI_ERROR(ret) && ret != EFI_UNSUPPORTED) {
+			efi_perror(ret, L"UDP service DestroyChild failed");
+			return ret;
+		}
+		udp_srv_binding = NULL;
+	}
+
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS udp_run(void)
+{
+	if (!udp)
+		return EFI_SUCCESS;
+
+	return uefi_call_wrapper(udp->Poll, 1, udp);
+}
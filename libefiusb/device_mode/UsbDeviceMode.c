@@ -51,6 +51,17 @@ USB_DEVICE_IO_REQ  mCtrlIoReq = {
 //
 BOOLEAN mXdciRun = FALSE;
 
+//
+// The run loop polls the controller without delay while events keep
+// coming and waits for the next timer tick once it has been idle for
+// USB_IDLE_POLL_COUNT iterations
+//
+#define USB_IDLE_POLL_COUNT   2000
+#define USB_IDLE_WAIT         10000   // 1 ms, in 100 ns units
+
+STATIC UINT32     mIdleCount;
+STATIC EFI_EVENT  mIdleTimer;
+
 VOID
 XhciSwitchSwid(BOOLEAN enable)
 {
@@ -117,6 +128,76 @@ UsbdMonitorEvents (
   return;
 }
 
+/**
+  Services the pending controller events from the run loop
+
+  @param XdciDevContext  Pointer to the device context
+
+  @return TRUE if there were events to process, FALSE otherwise
+
+**/
+STATIC
+BOOLEAN
+UsbdServiceEvents (
+  IN USB_XDCI_DEV_CONTEXT    *XdciDevContext
+  )
+{
+  UINT32                  EventCount;
+  EFI_TPL                 OldTpl;
+
+  EventCount = UsbRegRead ((UINT32)XdciDevContext->XdciMmioBarAddr, DWC_XDCI_EVNTCOUNT_REG (0));
+
+  if (XdciDevContext->XdciPollTimer == NULL) {
+    if (UsbDeviceIsrRoutine (mDrvObj.XdciDrvObj) != EFI_SUCCESS) {
+      DEBUG ((DEBUG_INFO, "UsbDeviceRun() - Failed to execute event ISR\n"));
+    }
+  } else if (EventCount != 0) {
+    //
+    // The poll timer only takes over when the run loop is not called:
+    // keep its notification out while the run loop services the events
+    //
+    OldTpl = uefi_call_wrapper(BS->RaiseTPL, 1, TPL_NOTIFY);
+    UsbdMonitorEvents (NULL, XdciDevContext);
+    uefi_call_wrapper(BS->RestoreTPL, 1, OldTpl);
+  }
+
+  return EventCount != 0;
+}
+
+/**
+  Waits for the next timer tick, letting the CPU idle in the meantime.
+  Falls back to a short stall if the wait cannot be set up.
+
+**/
+STATIC
+VOID
+UsbdIdleWait (
+  VOID
+  )
+{
+  EFI_STATUS  Status;
+  UINTN       Index;
+
+  if (mIdleTimer == NULL) {
+    Status = uefi_call_wrapper(BS->CreateEvent, 5, EVT_TIMER, 0, NULL, NULL, &mIdleTimer);
+    if (EFI_ERROR (Status)) {
+      mIdleTimer = NULL;
+    }
+  }
+
+  if (mIdleTimer != NULL) {
+    Status = uefi_call_wrapper(BS->SetTimer, 3, mIdleTimer, TimerRelative, USB_IDLE_WAIT);
+    if (!EFI_ERROR (Status)) {
+      Status = uefi_call_wrapper(BS->WaitForEvent, 3, 1, &mIdleTimer, &Index);
+      if (!EFI_ERROR (Status)) {
+        return;
+      }
+    }
+  }
+
+  uefi_call_wrapper(BS->Stall, 1, 50);
+}
+
 /**
   Initializes the XDCI core
 
@@ -1303,10 +1384,10 @@ UsbDeviceRun (
     // start the Event processing loop
     //
     while (TRUE) {
-      if (XdciDevContext->XdciPollTimer == NULL) {
-        if (UsbDeviceIsrRoutine (mDrvObj.XdciDrvObj) != EFI_SUCCESS) {
-          DEBUG ((DEBUG_INFO, "UsbDeviceRun() - Failed to execute event ISR\n"));
-        }
+      if (UsbdServiceEvents (XdciDevContext)) {
+        mIdleCount = 0;
+      } else if (mIdleCount < USB_IDLE_POLL_COUNT) {
+        mIdleCount++;
       }
 
       //
@@ -1319,6 +1400,10 @@ UsbDeviceRun (
           uefi_call_wrapper(BS->CloseEvent, 1, XdciDevContext->XdciPollTimer);
           XdciDevContext->XdciPollTimer = NULL;
         }
+        if (mIdleTimer != NULL) {
+          uefi_call_wrapper(BS->CloseEvent, 1, mIdleTimer);
+          mIdleTimer = NULL;
+        }
         Status = EFI_SUCCESS;
         DEBUG ((DEBUG_INFO, "UsbDeviceRun() - processing was cancelled\n"));
         break;
@@ -1329,7 +1414,9 @@ UsbDeviceRun (
       //
       if (TimeoutMs == 0)
         return EFI_TIMEOUT;
-      uefi_call_wrapper(BS->Stall, 1, 50);
+      if (mIdleCount >= USB_IDLE_POLL_COUNT) {
+        UsbdIdleWait ();
+      }
       TimeoutMs--;
     }
   }
@@ -19,6 +19,14 @@
 #include "XdciInterface.h"
 #include "XdciDWC.h"
 
+STATIC
+EFI_STATUS
+DwcXdciEpStartRx (
+  IN XDCI_CORE_HANDLE    *LocalCoreHandle,
+  IN UINT32              EpNum,
+  IN USB_XFER_REQUEST    *XferReq
+  );
+
 UINT32
 UsbRegRead (
   IN UINT32    Base,
@@ -686,6 +694,7 @@ DwcXdciEndXfer (
   }
 
   CoreHandle->EpHandles[EpNum].CheckFlag = FALSE;
+  CoreHandle->EpHandles[EpNum].RxQueueCount = 0;
 
   //
   // Issue a DEPENDXFER for EP
@@ -1206,6 +1215,7 @@ DwcXdciProcessEpXferDone (
   DWC_XDCI_ENDPOINT    *epHandle;
   DWC_XDCI_TRB         *Trb;
   USB_XFER_REQUEST     *XferReq;
+  USB_XFER_REQUEST     DoneReq;
   UINT32               remainingLen;
 
   if (EpNum > DWC_XDCI_MAX_ENDPOINTS) {
@@ -1247,6 +1257,25 @@ DwcXdciProcessEpXferDone (
     XferReq->ActualXferLen -= remainingLen;
   }
 
+  //
+  // Start the next queued receive request before notifying the upper
+  // layer so that the endpoint is ready again as soon as possible. A
+  // short packet ends the data stream the host is sending, the
+  // requests queued behind it are dropped.
+  //
+  if (epHandle->RxQueueCount > 0) {
+    CopyMem (&DoneReq, XferReq, sizeof (USB_XFER_REQUEST));
+    XferReq = &DoneReq;
+
+    if (DoneReq.ActualXferLen < DoneReq.XferLen) {
+      epHandle->RxQueueCount = 0;
+    } else {
+      epHandle->RxQueueCount--;
+      DwcXdciEpStartRx (CoreHandle, EpNum, &epHandle->RxQueue[epHandle->RxQueueHead]);
+      epHandle->RxQueueHead = (epHandle->RxQueueHead + 1) % DWC_XDCI_RX_QUEUE_DEPTH;
+    }
+  }
+
   //
   // Notify upper layer of request-specific transfer completion
   // if there is a callback specifically for this request
@@ -1263,7 +1292,7 @@ DwcXdciProcessEpXferDone (
     CoreHandle->EventCallbacks.CbEventParams.EpNum = (EpNum >> 1);
     CoreHandle->EventCallbacks.CbEventParams.EpDir = (EpNum & 1);
     CoreHandle->EventCallbacks.CbEventParams.EpType = epHandle->EpInfo.EpType;
-    CoreHandle->EventCallbacks.CbEventParams.Buffer = (UINT8 *)(UINTN)(epHandle->Trb->BuffPtrLow);
+    CoreHandle->EventCallbacks.CbEventParams.Buffer = XferReq->XferBuffer;
     CoreHandle->EventCallbacks.DevXferDoneCallback (&CoreHandle->EventCallbacks.CbEventParams);
   }
 
@@ -2584,6 +2613,7 @@ DwcXdciInitEp (
   // Init CheckFlag
   //
   LocalCoreHandle->EpHandles[EpNum].CheckFlag = FALSE;
+  LocalCoreHandle->EpHandles[EpNum].RxQueueCount = 0;
 
   //
   // Init DEPCFG cmd params for EP
@@ -3322,51 +3352,29 @@ DwcXdciEpTxData (
 
 
 /**
-  Interface:
-  This function is used to receive data on non-EP0 endpoint
+  Internal function:
+  This function is used to program the TRBs of an OUT endpoint
+  and to start the transfer described by the request
   @CoreHandle: xDCI controller handle
-  @EpInfo: Address of structure describing properties of EP
-  @Buffer: Buffer containing data to transmit
-  @size: Size of transfer (in bytes)
+  @EpNum: Physical endpoint number
+  @XferReq: Address to the transfer request describing this transfer
 
 **/
+STATIC
 EFI_STATUS
-EFIAPI
-DwcXdciEpRxData (
-  IN VOID                *CoreHandle,
+DwcXdciEpStartRx (
+  IN XDCI_CORE_HANDLE    *LocalCoreHandle,
+  IN UINT32              EpNum,
   IN USB_XFER_REQUEST    *XferReq
   )
 {
-  XDCI_CORE_HANDLE              *LocalCoreHandle = (XDCI_CORE_HANDLE *)CoreHandle;
   DWC_XDCI_ENDPOINT_CMD_PARAMS  EpCmdParams;
   DWC_XDCI_TRB                  *Trb;
   DWC_XDCI_TRB_CONTROL          TrbCtrl;
   EFI_STATUS                    Status;
-  UINT32                        EpNum;
   UINT32                        BaseAddr;
 
-  if (CoreHandle == NULL) {
-    DEBUG ((DEBUG_INFO, "DwcXdciEpRxData: INVALID handle\n"));
-    return EFI_DEVICE_ERROR;
-  }
-
-  if (XferReq == NULL) {
-    DEBUG ((DEBUG_INFO, "DwcXdciEpRxData: INVALID transfer request\n"));
-    return EFI_INVALID_PARAMETER;
-  }
-
   BaseAddr = LocalCoreHandle->BaseAddress;
-
-  //
-  // Convert to physical endpoint
-  //
-  EpNum = DwcXdciGetPhysicalEpNum (XferReq->EpInfo.EpNum, XferReq->EpInfo.EpDir);
-
-  if (EpNum >= DWC_XDCI_MAX_ENDPOINTS * 2) {
-    DEBUG ((DEBUG_INFO, "DwcXdciEpClearStall: INVALID EpNum\n"));
-    return EFI_DEVICE_ERROR;
-  }
-
   Trb = (LocalCoreHandle->Trbs + (EpNum * DWC_XDCI_TRB_NUM));
   DEBUG ((DEBUG_INFO, "(DwcXdciEpRxData)EpNum is %d\n", EpNum));
 
@@ -3375,14 +3383,6 @@ DwcXdciEpRxData (
   else
     TrbCtrl = TRBCTL_CTRL_DATA_PHASE;
 
-  //
-  // If CheckFlag didn't set to FALSE, means the previous transfer request didn't complete,
-  // need to wait the previous request done.
-  //
-  if (LocalCoreHandle->EpHandles[EpNum].CheckFlag == TRUE) {
-    return EFI_NOT_READY;
-  }
-
   LocalCoreHandle->EpHandles[EpNum].CheckFlag = TRUE;
 
   //
@@ -3442,6 +3442,71 @@ DwcXdciEpRxData (
 }
 
 
+/**
+  Interface:
+  This function is used to receive data on non-EP0 endpoint
+  @CoreHandle: xDCI controller handle
+  @EpInfo: Address of structure describing properties of EP
+  @Buffer: Buffer containing data to transmit
+  @size: Size of transfer (in bytes)
+
+**/
+EFI_STATUS
+EFIAPI
+DwcXdciEpRxData (
+  IN VOID                *CoreHandle,
+  IN USB_XFER_REQUEST    *XferReq
+  )
+{
+  XDCI_CORE_HANDLE              *LocalCoreHandle = (XDCI_CORE_HANDLE *)CoreHandle;
+  DWC_XDCI_ENDPOINT             *EpHandle;
+  UINT32                        EpNum;
+
+  if (CoreHandle == NULL) {
+    DEBUG ((DEBUG_INFO, "DwcXdciEpRxData: INVALID handle\n"));
+    return EFI_DEVICE_ERROR;
+  }
+
+  if (XferReq == NULL) {
+    DEBUG ((DEBUG_INFO, "DwcXdciEpRxData: INVALID transfer request\n"));
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // Convert to physical endpoint
+  //
+  EpNum = DwcXdciGetPhysicalEpNum (XferReq->EpInfo.EpNum, XferReq->EpInfo.EpDir);
+
+  if (EpNum >= DWC_XDCI_MAX_ENDPOINTS * 2) {
+    DEBUG ((DEBUG_INFO, "DwcXdciEpClearStall: INVALID EpNum\n"));
+    return EFI_DEVICE_ERROR;
+  }
+
+  EpHandle = &LocalCoreHandle->EpHandles[EpNum];
+
+  //
+  // If CheckFlag didn't set to FALSE, means the previous transfer request didn't complete.
+  // Non-control endpoints queue the request, it is started as soon as the previous
+  // one is done so that the endpoint does not NAK in between.
+  //
+  if (EpHandle->CheckFlag == TRUE) {
+    if (EpNum <= 1 || EpHandle->RxQueueCount == DWC_XDCI_RX_QUEUE_DEPTH) {
+      return EFI_NOT_READY;
+    }
+
+    CopyMem (
+      &EpHandle->RxQueue[(EpHandle->RxQueueHead + EpHandle->RxQueueCount) % DWC_XDCI_RX_QUEUE_DEPTH],
+      XferReq,
+      sizeof (USB_XFER_REQUEST)
+      );
+    EpHandle->RxQueueCount++;
+    return EFI_SUCCESS;
+  }
+
+  return DwcXdciEpStartRx (LocalCoreHandle, EpNum, XferReq);
+}
+
+
 
 STATIC
 EFI_STATUS
@@ -31,6 +31,12 @@
 #define DWC_XDCI_TRB_NUM                                   (32)
 #define DWC_XDCI_MASK                                      (DWC_XDCI_TRB_NUM - 1)
 
+//
+// Number of receive requests that can be queued behind the active one
+// on a non-control OUT endpoint
+//
+#define DWC_XDCI_RX_QUEUE_DEPTH                            (4)
+
 #define DWC_XDCI_MAX_DELAY_ITERATIONS                      (1000)
 
 #define DWC_XDCI_GSBUSCFG0_REG                             (0xC100)
@@ -483,6 +489,9 @@ typedef struct  {
   USB_EP_STATE      State;
   USB_EP_STATE      OrgState;
   BOOLEAN           CheckFlag;
+  USB_XFER_REQUEST  RxQueue[DWC_XDCI_RX_QUEUE_DEPTH];
+  UINT32            RxQueueHead;
+  UINT32            RxQueueCount;
 } DWC_XDCI_ENDPOINT;
 
 typedef struct {
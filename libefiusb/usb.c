@@ -56,6 +56,13 @@
 #define PRODUCT_ID		0x09EF
 #define BCD_DEVICE		0x0100
 
+/* Reads are split in requests of at most RX_REQ_SIZE bytes and up to
+   RX_QUEUE_DEPTH of them are queued at once when the device mode
+   driver accepts it, so that the OUT endpoint does not NAK while the
+   completion of the previous one is processed. */
+#define RX_REQ_SIZE		(8 * 1024 * 1024)
+#define RX_QUEUE_DEPTH		4
+
 static data_callback_t		rx_callback  = NULL;
 static data_callback_t		tx_callback  = NULL;
 static start_callback_t		start_callback = NULL;
@@ -67,6 +74,13 @@ static USB_DEVICE_ENDPOINT_OBJ	gEndpointObjs[ENDPOINT_COUNT];
 EFI_GUID gEfiUsbDeviceModeProtocolGuid = EFI_USB_DEVICE_MODE_PROTOCOL_GUID;
 static EFI_USB_DEVICE_MODE_PROTOCOL *usb_device = NULL;
 
+static struct rx {
+	char *buf;		/* First byte not received yet */
+	char *next;		/* First byte not requested yet */
+	char *end;
+	UINTN pending;		/* Number of queued requests */
+} rx;
+
 /* String descriptor table indexes */
 typedef enum {
 	STR_TBL_LANG,
@@ -178,27 +192,57 @@ EFI_STATUS usb_write(void *buf, UINT32 size)
 	return ret;
 }
 
-EFI_STATUS usb_read(void *buf, UINT32 size)
+static EFI_STATUS queue_rx_requests(void)
 {
 	EFI_STATUS ret;
 	USB_DEVICE_IO_REQ ioReq;
+	UINT32 size;
+
+	while (rx.pending < RX_QUEUE_DEPTH && rx.next < rx.end) {
+		size = min((UINTN)(rx.end - rx.next), (UINTN)RX_REQ_SIZE);
+
+		ioReq.EndpointInfo.EndpointDesc = &config_descriptor.ep_out;
+		ioReq.EndpointInfo.EndpointCompDesc = NULL;
+		ioReq.IoInfo.Buffer = rx.next;
+		ioReq.IoInfo.Length = size;
+
+		/* queue the  receive request */
+		ret = uefi_call_wrapper(usb_device->EpRxData, 2, usb_device, &ioReq);
+		/* The driver does not queue requests, the next one is
+		   queued on completion. */
+		if (ret == EFI_NOT_READY && rx.pending)
+			break;
+		if (EFI_ERROR(ret)) {
+			efi_perror(ret, L"failed to queue Rx request");
+			return ret;
+		}
+
+		rx.next += size;
+		rx.pending++;
+	}
+
+	return EFI_SUCCESS;
+}
 
+EFI_STATUS usb_read(void *buf, UINT32 size)
+{
 	/* WA: usb device stack doesn't accept rx buffer not multiple of MaxPacketSize */
 	unsigned max_pkt_size = config_descriptor.ep_out.MaxPacketSize;
 
 	size = ALIGN(size, max_pkt_size);
 
-	ioReq.EndpointInfo.EndpointDesc = &config_descriptor.ep_out;
-	ioReq.EndpointInfo.EndpointCompDesc = NULL;
-	ioReq.IoInfo.Buffer = buf;
-	ioReq.IoInfo.Length = size;
+	/* Reading the rest of the current buffer: the requests
+	   covering it are already queued. */
+	if (rx.pending && buf == rx.buf && (char *)buf + size == rx.end)
+		return queue_rx_requests();
 
-	/* queue the  receive request */
-	ret = uefi_call_wrapper(usb_device->EpRxData, 2, usb_device, &ioReq);
-	if (EFI_ERROR(ret))
-		efi_perror(ret, L"failed to queue Rx request");
+	if (rx.pending)
+		return EFI_NOT_READY;
 
-	return ret;
+	rx.buf = rx.next = buf;
+	rx.end = (char *)buf + size;
+
+	return queue_rx_requests();
 }
 
 static EFIAPI EFI_STATUS setup_handler(__attribute__((__unused__)) EFI_USB_DEVICE_REQUEST *CtrlRequest,
@@ -235,6 +279,16 @@ EFIAPI EFI_STATUS data_handler(EFI_USB_DEVICE_XFER_INFO *XferInfo)
 
 	/* if we are receiving a command or data, call the processing routine */
 	if (XferInfo->EndpointDir == USB_ENDPOINT_DIR_OUT) {
+		if (rx.pending) {
+			rx.pending--;
+			/* A short packet ends the transfer, the driver
+			   drops the requests queued behind it. */
+			if (XferInfo->Length < min((UINTN)(rx.end - rx.buf), (UINTN)RX_REQ_SIZE))
+				rx.pending = 0;
+			rx.buf += XferInfo->Length;
+			if (!rx.pending)
+				rx.buf = rx.next = rx.end = NULL;
+		}
 		if (rx_callback)
 			rx_callback(XferInfo->Buffer, XferInfo->Length);
 	} else
@@ -446,6 +500,8 @@ EFI_STATUS usb_stop(void)
 	start_callback = NULL;
 	rx_callback = NULL;
 	tx_callback = NULL;
+	rx.buf = rx.next = rx.end = NULL;
+	rx.pending = 0;
 
 	return ret;
 }
@@ -24,6 +24,7 @@ SHARED_SRC_FILES := \
 	fastboot_oem.c \
 	fastboot_flashing.c \
 	flash.c \
+	flash_profile.c \
 	sparse.c \
 	info.c \
 	intel_variables.c \
@@ -42,7 +43,8 @@ LOCAL_C_INCLUDES := $(SHARED_C_INCLUDES) \
 	$(addprefix $(LOCAL_PATH)/../,avb) \
 	$(addprefix $(LOCAL_PATH)/../,libsslsupport)
 LOCAL_SRC_FILES := $(SHARED_SRC_FILES) \
-	fastboot_transport.c
+	fastboot_transport.c \
+	fastboot_udp.c
 ifneq ($(strip $(KERNELFLINGER_USE_UI)),false)
     LOCAL_SRC_FILES += fastboot_ui.c
 endif
@@ -46,6 +46,8 @@
 #include "gpt.h"
 #include "fastboot.h"
 #include "flash.h"
+#include "flash_profile.h"
+#include "sparse_format.h"
 #include "fastboot_oem.h"
 #include "fastboot_flashing.h"
 #include "fastboot_ui.h"
@@ -69,20 +71,19 @@
 #endif
 
 struct fastboot_var {
-	struct fastboot_var *next;
+	struct fastboot_var *next;	/* registration order */
+	struct fastboot_var *prev;
+	struct fastboot_var *family_next;
 	char name[MAX_VARIABLE_LENGTH];
 	char value[MAX_VARIABLE_LENGTH];
 	const char *(*get_value)(void);
 };
 
-struct fastboot_tx_buffer {
-	struct fastboot_tx_buffer *next;
-	char msg[MAGIC_LENGTH];
-};
-
+/* Open addressing hash table of commands. */
 struct cmdlist {
-	struct cmdlist *next;
-	struct fastboot_cmd *cmd;
+	struct fastboot_cmd **table;
+	UINTN size;
+	UINTN count;
 };
 
 enum fastboot_states {
@@ -100,8 +101,27 @@ enum fastboot_states {
 static cmdlist_t cmdlist;
 static char *command_buffer;
 static UINTN command_buffer_size;
-static struct fastboot_var *varlist;
-static struct fastboot_tx_buffer *txbuf_head;
+/* Variables are kept in registration order for "getvar all" and
+   indexed by name in an open addressing hash table.  They are also
+   chained in buckets by family, that is the beginning of the name
+   up to the first '-' or ':', to delete them by prefix. */
+static struct fastboot_var *varlist, *varlist_tail;
+static struct fastboot_var **var_index;
+static UINTN var_index_size, var_index_used, var_count;
+#define VAR_FAMILIES 64
+static struct fastboot_var *var_families[VAR_FAMILIES];
+#define DELETED_VAR ((struct fastboot_var *)1)
+#define MIN_INDEX_SIZE 64
+/* Ring of the buffered response messages.  Messages are formatted
+   in place and the transport sends them straight from their slot, so
+   the head slot stays in the ring until its transmission completes.
+   The ring only grows: a replaced ring is freed once the message it
+   is transmitting is done. */
+#define TX_RING_MIN_SLOTS 256
+static char (*tx_ring)[MAGIC_LENGTH];
+static char (*tx_ring_retired)[MAGIC_LENGTH];
+static UINTN tx_ring_size, tx_head, tx_count;
+static BOOLEAN tx_in_flight;
 static enum fastboot_states fastboot_state;
 static enum fastboot_states next_state;
 
@@ -109,6 +129,36 @@ static enum fastboot_states next_state;
 static struct download_buffer dl;
 static const UINTN MIN_DLSIZE = 8 * 1024 * 1024;
 static const UINTN MAX_DLSIZE = 256 * 1024 * 1024;
+/* Page-allocated download buffer, sized from the memory map.  It is
+   aligned on huge pages and limited to what the 32 bits download
+   command size can express. */
+static const UINT64 DL_ALIGN = 2 * 1024 * 1024;
+static const UINT64 DL_SIZE_LIMIT = 0x100000000ULL - 2 * 1024 * 1024;
+/* Memory below 4 GiB left free for the boot image loading and the
+   transports DMA buffers when the download buffer is allocated
+   there. */
+static const EFI_PHYSICAL_ADDRESS LOW_MEMORY_END = 0x100000000ULL;
+static const UINT64 DL_LOW_RESERVE = 512 * 1024 * 1024;
+static UINTN dl_pages;
+
+/* Flash while receiving: when a partition has been armed with the
+   "oem flash-stream" command, the next download is written to this
+   partition as it arrives.  Arming only covers a download which
+   immediately follows the arming command: the following flash command
+   of the same partition reports the result and arms the partition
+   again for the next piece of the image, any other command disables
+   streaming. */
+static CHAR16 *stream_label;
+static UINTN stream_armed_at;
+static UINTN command_count;
+static CHAR16 *stream_target;
+static BOOLEAN dl_streamed;
+/* The streamed data does not come from a download. */
+static BOOLEAN stream_local;
+static EFI_STATUS stream_status;
+static UINTN streamed_len;
+/* The download stream has not been closed yet. */
+static BOOLEAN stream_open;
 
 #ifndef FASTBOOT_FOR_NON_ANDROID
 static const char *flash_locked_whitelist[] = {
@@ -184,21 +234,81 @@ EFI_STATUS fastboot_set_command_buffer(char *buffer, UINTN size)
 	return EFI_SUCCESS;
 }
 
+/* FNV-1a hash of the first LEN characters of STR, or of the whole
+   string if LEN is 0. */
+static UINTN hash_string(const char *str, UINTN len)
+{
+	UINT32 hash = 2166136261U;
+	UINTN i;
+
+	for (i = 0; str[i] && (!len || i < len); i++) {
+		hash ^= (UINT8)str[i];
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+static EFI_STATUS cmdlist_grow(cmdlist_t list)
+{
+	struct fastboot_cmd **table, **old = list->table;
+	UINTN i, j, size = max(list->size * 2, (UINTN)MIN_INDEX_SIZE);
+
+	table = AllocateZeroPool(size * sizeof(*table));
+	if (!table)
+		return EFI_OUT_OF_RESOURCES;
+
+	for (i = 0; i < list->size; i++) {
+		if (!old[i])
+			continue;
+		j = hash_string(old[i]->name, 0) & (size - 1);
+		while (table[j])
+			j = (j + 1) & (size - 1);
+		table[j] = old[i];
+	}
+
+	if (old)
+		FreePool(old);
+	list->table = table;
+	list->size = size;
+
+	return EFI_SUCCESS;
+}
+
+/* A command registered with the same name as an existing one
+   replaces it. */
 EFI_STATUS fastboot_register_into(cmdlist_t *list, struct fastboot_cmd *cmd)
 {
-	cmdlist_t node;
+	EFI_STATUS ret;
+	UINTN i;
 
 	if (!list || !cmd)
 		return EFI_INVALID_PARAMETER;
 
-	node = AllocatePool(sizeof(*node));
-	if (!node) {
-		error(L"Failed to allocate fastboot command %a", cmd->name);
-		return EFI_OUT_OF_RESOURCES;
+	if (!*list) {
+		*list = AllocateZeroPool(sizeof(**list));
+		if (!*list) {
+			error(L"Failed to allocate fastboot command %a", cmd->name);
+			return EFI_OUT_OF_RESOURCES;
+		}
+	}
+
+	if (((*list)->count + 1) * 4 > (*list)->size * 3) {
+		ret = cmdlist_grow(*list);
+		if (EFI_ERROR(ret)) {
+			error(L"Failed to allocate fastboot command %a", cmd->name);
+			return ret;
+		}
 	}
-	node->cmd = cmd;
-	node->next = *list;
-	*list = node;
+
+	i = hash_string(cmd->name, 0) & ((*list)->size - 1);
+	while ((*list)->table[i] &&
+	       strcmp((CHAR8 *)cmd->name, (CHAR8 *)(*list)->table[i]->name))
+		i = (i + 1) & ((*list)->size - 1);
+
+	if (!(*list)->table[i])
+		(*list)->count++;
+	(*list)->table[i] = cmd;
 
 	return EFI_SUCCESS;
 }
@@ -210,32 +320,106 @@ EFI_STATUS fastboot_register(struct fastboot_cmd *cmd)
 
 void fastboot_cmdlist_unregister(cmdlist_t *list)
 {
-	cmdlist_t next, node;
-
-	if (!list)
+	if (!list || !*list)
 		return;
 
-	for (node = *list; node; node = next) {
-		next = node->next;
-		FreePool(node);
-	}
+	if ((*list)->table)
+		FreePool((*list)->table);
+	FreePool(*list);
 	*list = NULL;
 }
 
-struct fastboot_var *fastboot_getvar(const char *name)
+/* Return the index slot holding NAME or NULL if it is not indexed.
+   Deleted slots are skipped. */
+static struct fastboot_var **var_index_lookup(const char *name)
 {
-	struct fastboot_var *var;
+	struct fastboot_var **slot;
+	UINTN i;
+
+	if (!var_index)
+		return NULL;
 
-	for (var = varlist; var; var = var->next)
-		if (!strcmp((CHAR8 *)name, (const CHAR8 *)var->name))
-			return var;
+	i = hash_string(name, 0) & (var_index_size - 1);
+	for (;; i = (i + 1) & (var_index_size - 1)) {
+		slot = &var_index[i];
+		if (!*slot)
+			return NULL;
+		if (*slot != DELETED_VAR &&
+		    !strcmp((CHAR8 *)name, (const CHAR8 *)(*slot)->name))
+			return slot;
+	}
+}
 
-	return NULL;
+/* Return the slot where NAME, which is not indexed, is to be
+   inserted: the first deleted slot on its probe sequence or the
+   empty slot ending it. */
+static struct fastboot_var **var_index_insert_slot(const char *name)
+{
+	struct fastboot_var **slot;
+	UINTN i;
+
+	i = hash_string(name, 0) & (var_index_size - 1);
+	for (;; i = (i + 1) & (var_index_size - 1)) {
+		slot = &var_index[i];
+		if (!*slot || *slot == DELETED_VAR)
+			return slot;
+	}
+}
+
+static EFI_STATUS var_index_rebuild(void)
+{
+	struct fastboot_var **index, *var;
+	UINTN i, size = MIN_INDEX_SIZE;
+
+	while ((var_count + 1) * 2 > size)
+		size *= 2;
+
+	index = AllocateZeroPool(size * sizeof(*index));
+	if (!index)
+		return EFI_OUT_OF_RESOURCES;
+
+	for (var = varlist; var; var = var->next) {
+		i = hash_string(var->name, 0) & (size - 1);
+		while (index[i])
+			i = (i + 1) & (size - 1);
+		index[i] = var;
+	}
+
+	if (var_index)
+		FreePool(var_index);
+	var_index = index;
+	var_index_size = size;
+	var_index_used = var_count;
+
+	return EFI_SUCCESS;
+}
+
+static UINTN family_length(const char *name)
+{
+	UINTN i;
+
+	for (i = 0; name[i]; i++)
+		if (name[i] == '-' || name[i] == ':')
+			return i + 1;
+
+	return 0;
+}
+
+static struct fastboot_var **family_bucket(const char *name)
+{
+	return &var_families[hash_string(name, family_length(name)) % VAR_FAMILIES];
+}
+
+struct fastboot_var *fastboot_getvar(const char *name)
+{
+	struct fastboot_var **slot = var_index_lookup(name);
+
+	return slot ? *slot : NULL;
 }
 
 static struct fastboot_var *fastboot_getvar_or_create(const char *name)
 {
-	struct fastboot_var *var;
+	struct fastboot_var *var, **slot, **bucket;
 	UINTN size;
 
 	size = strlena((CHAR8 *) name) + 1;
@@ -245,36 +429,79 @@ static struct fastboot_var *fastboot_getvar_or_create(const char *name)
 	}
 
 	var = fastboot_getvar(name);
+	if (var)
+		return var;
+
+	if ((var_index_used + 1) * 4 > var_index_size * 3 &&
+	    EFI_ERROR(var_index_rebuild())) {
+		error(L"Failed to allocate variable '%a'", name);
+		return NULL;
+	}
+
+	var = AllocateZeroPool(sizeof(*var));
 	if (!var) {
-		var = AllocateZeroPool(sizeof(*var));
-		if (!var) {
-			error(L"Failed to allocate variable '%a'", name);
-			return NULL;
-		}
-		var->next = varlist;
-		varlist = var;
-		CopyMem(var->name, name, size);
+		error(L"Failed to allocate variable '%a'", name);
+		return NULL;
 	}
+	CopyMem(var->name, name, size);
+
+	slot = var_index_insert_slot(name);
+	if (!*slot)
+		var_index_used++;
+	*slot = var;
+
+	var->prev = varlist_tail;
+	if (varlist_tail)
+		varlist_tail->next = var;
+	else
+		varlist = var;
+	varlist_tail = var;
+
+	bucket = family_bucket(name);
+	var->family_next = *bucket;
+	*bucket = var;
+	var_count++;
 
 	return var;
 }
 
-static void delete_var_starting_with(const char *prefix)
+static void delete_var(struct fastboot_var *var)
 {
-	struct fastboot_var *var;
-	struct fastboot_var *old_varlist;
-	struct fastboot_var *next;
+	*var_index_lookup(var->name) = DELETED_VAR;
 
-	old_varlist = varlist;
-	varlist = NULL;
+	if (var->prev)
+		var->prev->next = var->next;
+	else
+		varlist = var->next;
+	if (var->next)
+		var->next->prev = var->prev;
+	else
+		varlist_tail = var->prev;
 
-	for (var = old_varlist; var; var = next) {
-		next = var->next;
-		if (!memcmp(prefix, var->name, strlena((CHAR8 *)prefix))) {
-			FreePool(var);
-		} else {
-			var->next = varlist;
-			varlist = var;
+	var_count--;
+	FreePool(var);
+}
+
+/* Only the family bucket of PREFIX has to be looked at if PREFIX
+   covers a complete family name. */
+static void delete_var_starting_with(const char *prefix)
+{
+	struct fastboot_var **link, *var;
+	UINTN i, len = strlena((CHAR8 *)prefix);
+	UINTN first = 0, last = VAR_FAMILIES - 1;
+
+	if (family_length(prefix))
+		first = last = family_bucket(prefix) - var_families;
+
+	for (i = first; i <= last; i++) {
+		for (link = &var_families[i]; *link;) {
+			var = *link;
+			if (memcmp(prefix, var->name, len)) {
+				link = &var->family_next;
+				continue;
+			}
+			*link = var->family_next;
+			delete_var(var);
 		}
 	}
 }
@@ -288,7 +515,13 @@ static void fastboot_unpublish_all()
 		FreePool(var);
 	}
 
-	varlist = NULL;
+	varlist = varlist_tail = NULL;
+	ZeroMem(var_families, sizeof(var_families));
+	if (var_index) {
+		FreePool(var_index);
+		var_index = NULL;
+	}
+	var_index_size = var_index_used = var_count = 0;
 }
 
 EFI_STATUS fastboot_publish_dynamic(const char *name, const char *(get_value)(void))
@@ -612,6 +845,102 @@ static const char *get_erase_block_size_var()
 	return erase_block_size;
 }
 
+static const char *get_flash_write_tuning_var(BOOLEAN align)
+{
+	static char value[2][MAX_VARIABLE_LENGTH];
+	int len;
+	UINTN size, alignment;
+	EFI_STATUS ret;
+
+	ret = flash_get_write_tuning(&size, &alignment);
+	if (EFI_ERROR(ret))
+		return NULL;
+
+	len = efi_snprintf((CHAR8 *)value[align], sizeof(value[align]),
+			   (CHAR8 *)"0x%X", align ? alignment : size);
+	if (len < 0 || len >= (int)sizeof(value[align]))
+		return NULL;
+
+	return value[align];
+}
+
+enum transport_stat_var {
+	TRANSPORT_RX_BYTES,
+	TRANSPORT_TX_BYTES,
+	TRANSPORT_RX_RATE,
+	TRANSPORT_STALL,
+	TRANSPORT_STAT_VAR_LAST
+};
+
+static const char *get_transport_stat_var(enum transport_stat_var stat)
+{
+	static char value[TRANSPORT_STAT_VAR_LAST][MAX_VARIABLE_LENGTH];
+	struct transport_stats *stats;
+	UINT64 val = 0;
+	int len;
+
+	stats = transport_get_stats();
+	if (!stats)
+		return NULL;
+
+	switch (stat) {
+	case TRANSPORT_RX_BYTES:
+		val = stats->rx.bytes;
+		break;
+	case TRANSPORT_TX_BYTES:
+		val = stats->tx.bytes;
+		break;
+	case TRANSPORT_RX_RATE:
+		if (stats->rx.busy_usec)
+			val = stats->rx.bytes * 1000000 / stats->rx.busy_usec / 1024;
+		break;
+	case TRANSPORT_STALL:
+		val = stats->stall_usec / 1000;
+		break;
+	default:
+		return NULL;
+	}
+
+	len = efi_snprintf((CHAR8 *)value[stat], sizeof(value[stat]),
+			   stat == TRANSPORT_RX_RATE ? (CHAR8 *)"%ldKiB/s" :
+			   stat == TRANSPORT_STALL ? (CHAR8 *)"%ldms" : (CHAR8 *)"%ld",
+			   val);
+	if (len < 0 || len >= (int)sizeof(value[stat]))
+		return NULL;
+
+	return value[stat];
+}
+
+static const char *get_transport_rx_bytes_var()
+{
+	return get_transport_stat_var(TRANSPORT_RX_BYTES);
+}
+
+static const char *get_transport_tx_bytes_var()
+{
+	return get_transport_stat_var(TRANSPORT_TX_BYTES);
+}
+
+static const char *get_transport_rx_rate_var()
+{
+	return get_transport_stat_var(TRANSPORT_RX_RATE);
+}
+
+static const char *get_transport_stall_var()
+{
+	return get_transport_stat_var(TRANSPORT_STALL);
+}
+
+static const char *get_flash_write_size_var()
+{
+	return get_flash_write_tuning_var(FALSE);
+}
+
+static const char *get_flash_write_align_var()
+{
+	return get_flash_write_tuning_var(TRUE);
+}
+
 static const char *get_logical_block_size_var()
 {
 	static char logical_block_size[MAX_VARIABLE_LENGTH];
@@ -668,31 +997,61 @@ void fastboot_ack(const char *code, const char *fmt, va_list ap)
 		fastboot_state = STATE_ERROR;
 }
 
+static char *tx_ring_reserve(void)
+{
+	char (*ring)[MAGIC_LENGTH];
+	UINTN i, size;
+
+	if (tx_count == tx_ring_size) {
+		size = max(tx_ring_size * 2, (UINTN)TX_RING_MIN_SLOTS);
+		ring = AllocatePool(size * sizeof(*ring));
+		if (!ring)
+			return NULL;
+
+		for (i = 0; i < tx_count; i++)
+			CopyMem(ring[i], tx_ring[(tx_head + i) % tx_ring_size], sizeof(*ring));
+
+		if (tx_ring) {
+			if (tx_in_flight && !tx_ring_retired)
+				tx_ring_retired = tx_ring;
+			else
+				FreePool(tx_ring);
+		}
+		tx_ring = ring;
+		tx_ring_size = size;
+		tx_head = 0;
+	}
+
+	return tx_ring[(tx_head + tx_count++) % tx_ring_size];
+}
+
+static void tx_ring_free(void)
+{
+	if (tx_ring)
+		FreePool(tx_ring);
+	if (tx_ring_retired)
+		FreePool(tx_ring_retired);
+	tx_ring = tx_ring_retired = NULL;
+	tx_ring_size = tx_head = tx_count = 0;
+	tx_in_flight = FALSE;
+}
+
 void fastboot_ack_buffered(const char *code, const char *fmt, va_list ap)
 {
-	struct fastboot_tx_buffer *new_txbuf;
-	struct fastboot_tx_buffer *txbuf;
+	char *msg;
 	EFI_STATUS ret;
 
-	new_txbuf = AllocateZeroPool(sizeof(*new_txbuf));
-	if (!new_txbuf) {
+	msg = tx_ring_reserve();
+	if (!msg) {
 		error(L"Failed to allocate memory");
 		return;
 	}
 
-	ret = fastboot_build_ack_msg(new_txbuf->msg, code, fmt, ap);
+	ret = fastboot_build_ack_msg(msg, code, fmt, ap);
 	if (EFI_ERROR(ret)) {
-		FreePool(new_txbuf);
+		tx_count--;
 		return;
 	}
-	if (!txbuf_head)
-		txbuf_head = new_txbuf;
-	else {
-		txbuf = txbuf_head;
-		while (txbuf->next)
-			txbuf = txbuf->next;
-		txbuf->next = new_txbuf;
-	}
 	fastboot_state = STATE_TX;
 }
 
@@ -753,22 +1112,28 @@ void fastboot_okay(const char *fmt, ...)
 static void flush_tx_buffer(void)
 {
 	EFI_STATUS ret;
-	struct fastboot_tx_buffer *msg;
-	static CHAR8 buf[sizeof(msg->msg)];
 
-	msg = txbuf_head;
-	txbuf_head = txbuf_head->next;
-	if (!txbuf_head)
-		fastboot_state = next_state;
+	/* The previously sent message is done. */
+	if (tx_in_flight) {
+		tx_head = (tx_head + 1) % tx_ring_size;
+		tx_count--;
+		tx_in_flight = FALSE;
+		if (tx_ring_retired) {
+			FreePool(tx_ring_retired);
+			tx_ring_retired = NULL;
+		}
+	}
 
-	ret = memcpy_s(buf, sizeof(buf), msg->msg, sizeof(buf));
-	FreePool(msg);
-	if (EFI_ERROR(ret)) {
-		fastboot_state = STATE_ERROR;
+	if (!tx_count) {
+		fastboot_state = next_state;
 		return;
 	}
 
-	ret = transport_write(buf, sizeof(buf));
+	if (tx_count == 1)
+		fastboot_state = next_state;
+
+	tx_in_flight = TRUE;
+	ret = transport_write(tx_ring[tx_head], MAGIC_LENGTH);
 	if (EFI_ERROR(ret))
 		fastboot_state = STATE_ERROR;
 }
@@ -836,18 +1201,38 @@ static void cmd_flash(INTN argc, CHAR8 **argv)
 
 	info(L"Flashing %s ...", label);
 
-	ret = flash(dl.data, dl.size, label);
+	if (dl_streamed && !StrCmp(label, stream_target)) {
+		ret = stream_status;
+		if (!EFI_ERROR(ret) && !stream_label && !stream_local) {
+			stream_label = stream_target;
+			stream_target = NULL;
+			stream_armed_at = command_count;
+		}
+	} else {
+		if (dl_streamed)
+			error(L"Download was streamed to %s, not %s",
+			      stream_target, label);
+		transport_stall_begin();
+		ret = flash(dl.data, dl.size, label);
+		transport_stall_end();
+	}
+	dl_streamed = FALSE;
+	stream_local = FALSE;
 	FreePool(label);
 	if (EFI_ERROR(ret)) {
 		fastboot_fail("Flash failure: %r", ret);
 		return;
 	}
 
+	flash_profile_begin(FLASH_STAGE_SYNC);
 	gpt_sync();
+	flash_profile_end(FLASH_STAGE_SYNC, 0);
 
 	/* update partition variable in case it has changed */
 	if (ret & REFRESH_PARTITION_VAR) {
+		flash_profile_begin(FLASH_STAGE_GPT);
 		ret = refresh_partition_var();
+		flash_profile_end(FLASH_STAGE_GPT, 0);
 		if (EFI_ERROR(ret)) {
 			fastboot_fail("Failed to publish partition variables, %r", ret);
 			return;
@@ -855,6 +1240,8 @@ static void cmd_flash(INTN argc, CHAR8 **argv)
 	}
 
 	info(L"Flash done.");
+	flash_profile_report();
+	flash_profile_reset();
 	fastboot_okay("");
 }
 
@@ -881,7 +1268,9 @@ static void cmd_erase(INTN argc, CHAR8 **argv)
 	}
 
 	info(L"Erasing %s ...", label);
+	transport_stall_begin();
 	ret = erase_by_label(label);
+	transport_stall_end();
 	if (EFI_ERROR(ret)) {
 		FreePool(label);
 		fastboot_fail("Erase failure: %r", ret);
@@ -1053,14 +1442,15 @@ static void cmd_set_active(INTN argc, CHAR8 **argv)
 
 static struct fastboot_cmd *get_cmd(cmdlist_t list, const char *name)
 {
-	cmdlist_t node;
+	UINTN i;
 
-	if (!name || !list)
+	if (!name || !list || !list->table)
 		return NULL;
 
-	for (node = list; node; node = node->next)
-		if (!strcmp((CHAR8 *)name, (CHAR8 *)node->cmd->name))
-			return node->cmd;
+	i = hash_string(name, 0) & (list->size - 1);
+	for (; list->table[i]; i = (i + 1) & (list->size - 1))
+		if (!strcmp((CHAR8 *)name, (CHAR8 *)list->table[i]->name))
+			return list->table[i];
 
 	return NULL;
 }
@@ -1094,6 +1484,127 @@ void fastboot_run_root_cmd(const char *name, INTN argc, CHAR8 **argv)
 	fastboot_run_cmd(cmdlist, name, argc, argv);
 }
 
+static EFI_STATUS get_stream_label(CHAR8 *label, CHAR16 **label16)
+{
+#ifndef FASTBOOT_FOR_NON_ANDROID
+	if (get_current_state() == LOCKED &&
+	    !is_in_white_list(label, flash_locked_whitelist))
+		return EFI_ACCESS_DENIED;
+#endif
+	*label16 = stra_to_str(label);
+	if (!*label16)
+		return EFI_OUT_OF_RESOURCES;
+
+	if (!can_erase_or_flash_partition(*label16)) {
+		FreePool(*label16);
+		return EFI_ACCESS_DENIED;
+	}
+
+	return EFI_SUCCESS;
+}
+
+/* Drop a download stream which will not be completed, as when the
+   transport is reset in the middle of the download. */
+static void stream_abort(void)
+{
+	if (!stream_open)
+		return;
+
+	flash_stream_abort();
+	stream_open = FALSE;
+	if (!EFI_ERROR(stream_status))
+		stream_status = EFI_ABORTED;
+}
+
+EFI_STATUS fastboot_set_flash_stream(CHAR8 *label)
+{
+	EFI_STATUS ret;
+	CHAR16 *label16 = NULL;
+
+	if (label) {
+		ret = get_stream_label(label, &label16);
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+
+	if (stream_label)
+		FreePool(stream_label);
+	stream_label = label16;
+	stream_armed_at = command_count;
+	dl_streamed = FALSE;
+	stream_local = FALSE;
+
+	return EFI_SUCCESS;
+}
+
+/* Stream data produced locally, such as files read by the installer,
+   into LABEL as a streamed download would.  The flash command of
+   LABEL then commits it. */
+EFI_STATUS fastboot_stream_open(CHAR8 *label)
+{
+	EFI_STATUS ret;
+	CHAR16 *label16;
+
+	ret = get_stream_label(label, &label16);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	stream_open = FALSE;
+	ret = flash_stream_open(label16);
+	if (EFI_ERROR(ret)) {
+		FreePool(label16);
+		return ret;
+	}
+
+	if (stream_target)
+		FreePool(stream_target);
+	stream_target = label16;
+	dl_streamed = TRUE;
+	stream_local = TRUE;
+	stream_status = EFI_SUCCESS;
+
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS fastboot_stream_write(void *data, UINTN size)
+{
+	if (!dl_streamed || !stream_local)
+		return EFI_NOT_STARTED;
+
+	if (!EFI_ERROR(stream_status))
+		stream_status = flash_stream_write(data, size);
+
+	return stream_status;
+}
+
+EFI_STATUS fastboot_stream_close(void)
+{
+	EFI_STATUS ret;
+
+	if (!dl_streamed || !stream_local)
+		return EFI_NOT_STARTED;
+
+	ret = flash_stream_close(stream_target);
+	if (!EFI_ERROR(stream_status))
+		stream_status = ret;
+
+	return stream_status;
+}
+
+/* Drop the local stream without committing it.  A partition armed
+   with "oem flash-stream" stays armed. */
+void fastboot_stream_abort(void)
+{
+	if (!dl_streamed || !stream_local)
+		return;
+
+	flash_stream_abort();
+	dl_streamed = FALSE;
+	stream_local = FALSE;
+	FreePool(stream_target);
+	stream_target = NULL;
+}
+
 static void fastboot_read_command(void)
 {
 	transport_read(command_buffer, command_buffer_size);
@@ -1123,6 +1634,33 @@ static void cmd_download(INTN argc, CHAR8 **argv)
 	}
 	ui_print(L"Receiving %ld bytes ...", dl.size);
 
+	stream_abort();
+	dl_streamed = FALSE;
+	stream_local = FALSE;
+	if (stream_target) {
+		FreePool(stream_target);
+		stream_target = NULL;
+	}
+	if (stream_label && stream_armed_at + 1 != command_count) {
+		/* Not armed by the previous command. */
+		FreePool(stream_label);
+		stream_label = NULL;
+	}
+	if (stream_label) {
+		/* The arming is consumed by this download. */
+		stream_target = stream_label;
+		stream_label = NULL;
+		ret = flash_stream_open(stream_target);
+		if (EFI_ERROR(ret))
+			efi_perror(ret, L"Cannot stream %s, flash after download", stream_target);
+		else {
+			dl_streamed = TRUE;
+			stream_open = TRUE;
+			stream_status = EFI_SUCCESS;
+			streamed_len = 0;
+		}
+	}
+
 	len = efi_snprintf(response, sizeof(response), (CHAR8 *)"DATA%08x",
 			   dl.size);
 	if (len < 0) {
@@ -1131,6 +1669,11 @@ static void cmd_download(INTN argc, CHAR8 **argv)
 		return;
 	}
 
+	flash_profile_reset();
+	/* Opened as a stage so that the writes streamed while
+	   receiving are not charged to the download. */
+	flash_profile_begin(FLASH_STAGE_DOWNLOAD);
+
 	fastboot_state = STATE_START_DOWNLOAD;
 	ret = transport_write(response, strlen((CHAR8 *)response));
 	if (EFI_ERROR(ret)) {
@@ -1193,6 +1736,14 @@ static void fastboot_run_command()
 		return;
 	}
 
+	/* Only the download right after the arming command is streamed,
+	   whatever the command in between is. */
+	command_count++;
+	if (stream_label && (!argc || strcmp(argv[0], (CHAR8 *)"download"))) {
+		FreePool(stream_label);
+		stream_label = NULL;
+	}
+
 	fastboot_run_root_cmd((char *)argv[0], argc, argv);
 	received_len = 0;
 	last_received_len = 0;
@@ -1201,6 +1752,56 @@ static void fastboot_run_command()
 		flush_tx_buffer();
 }
 
+/* Write the data received since the last call.  The next transport
+   read is already queued so the transfer goes on while the storage is
+   written.  This runs from the main loop and not from the transport
+   callbacks: these may run at a raised TPL where the storage
+   asynchronous I/O cannot be waited for. */
+static void fastboot_run_stream(void)
+{
+	EFI_STATUS ret;
+	unsigned len;
+
+	if (!stream_open)
+		return;
+
+	if (fastboot_state != STATE_START_DOWNLOAD &&
+	    fastboot_state != STATE_DOWNLOAD) {
+		error(L"Download interrupted, streaming to %s aborted", stream_target);
+		stream_abort();
+		return;
+	}
+
+	if (fastboot_state != STATE_DOWNLOAD)
+		return;
+
+	len = received_len;
+	if (!EFI_ERROR(stream_status) && len > streamed_len) {
+		/* Sparse image detection needs the complete header. */
+		if (!streamed_len && len < sizeof(struct sparse_header) &&
+		    len < dl.size)
+			return;
+
+		transport_stall_begin();
+		stream_status = flash_stream_write(dl.data + streamed_len,
+						   len - streamed_len);
+		transport_stall_end();
+		streamed_len = len;
+	}
+
+	if (len < dl.size)
+		return;
+
+	ret = flash_stream_close(stream_target);
+	stream_open = FALSE;
+	if (!EFI_ERROR(stream_status))
+		stream_status = ret;
+
+	flash_profile_end(FLASH_STAGE_DOWNLOAD, dl.size);
+	fastboot_state = STATE_COMPLETE;
+	fastboot_okay("");
+}
+
 static void fastboot_process_rx(void *buf, unsigned len)
 {
 	CHAR8 *s;
@@ -1212,7 +1813,11 @@ static void fastboot_process_rx(void *buf, unsigned len)
 		if (received_len < dl.size) {
 			s = buf;
 			transport_read(&s[len], dl.size - received_len);
-		} else {
+		}
+		/* Streamed downloads are acknowledged by
+		   fastboot_run_stream() once written. */
+		if (received_len >= dl.size && !dl_streamed) {
+			flash_profile_end(FLASH_STAGE_DOWNLOAD, dl.size);
 			fastboot_state = STATE_COMPLETE;
 			fastboot_okay("");
 		}
@@ -1239,10 +1844,103 @@ static void fastboot_start_callback(void)
 	fastboot_read_command();
 }
 
+/* Highest address the download buffer may be allocated at. */
+static EFI_PHYSICAL_ADDRESS dl_max_address(void)
+{
+#if defined(ARCH_X86_64) && defined(FASTBOOT_DOWNLOAD_ABOVE_4G)
+	return (EFI_PHYSICAL_ADDRESS)-1;
+#else
+	return LOW_MEMORY_END;
+#endif
+}
+
+/* Use half of the free conventional memory the buffer may be
+   allocated in, within the largest free region, so that the host
+   splits big images in fewer pieces. */
+static EFI_STATUS alloc_download_pages(void)
+{
+	EFI_STATUS ret;
+	EFI_MEMORY_DESCRIPTOR *map, *desc;
+	UINTN map_size = 0, map_key, desc_size;
+	UINT32 desc_version;
+	EFI_PHYSICAL_ADDRESS start, end, best_start = 0, addr;
+	UINT64 free_size = 0, low_size = 0, best_size = 0, size;
+	UINTN i;
+
+	ret = uefi_call_wrapper(BS->GetMemoryMap, 5, &map_size, NULL,
+				&map_key, &desc_size, &desc_version);
+	if (ret != EFI_BUFFER_TOO_SMALL)
+		return EFI_ERROR(ret) ? ret : EFI_NOT_FOUND;
+
+	/* Allocating the map buffer may add entries to the map. */
+	map_size += 2 * desc_size;
+	map = AllocatePool(map_size);
+	if (!map)
+		return EFI_OUT_OF_RESOURCES;
+
+	ret = uefi_call_wrapper(BS->GetMemoryMap, 5, &map_size, map,
+				&map_key, &desc_size, &desc_version);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to get the memory map");
+		FreePool(map);
+		return ret;
+	}
+
+	for (i = 0; i < map_size / desc_size; i++) {
+		desc = (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)map + i * desc_size);
+		if (desc->Type != EfiConventionalMemory)
+			continue;
+
+		start = desc->PhysicalStart;
+		end = start + (desc->NumberOfPages << EFI_PAGE_SHIFT);
+		if (start < LOW_MEMORY_END)
+			low_size += min(end, LOW_MEMORY_END) - start;
+
+		end = min(end, dl_max_address());
+		if (start >= end)
+			continue;
+		free_size += end - start;
+
+		start = (start + DL_ALIGN - 1) & ~(DL_ALIGN - 1);
+		if (start >= end || end - start <= best_size)
+			continue;
+
+		best_start = start;
+		best_size = end - start;
+	}
+	FreePool(map);
+
+	size = min(min(free_size / 2, best_size), DL_SIZE_LIMIT);
+	if (best_start < LOW_MEMORY_END)
+		size = low_size > DL_LOW_RESERVE ?
+			min(size, low_size - DL_LOW_RESERVE) : 0;
+	size &= ~(DL_ALIGN - 1);
+	if (size <= MAX_DLSIZE)
+		return EFI_OUT_OF_RESOURCES;
+
+	addr = best_start;
+	ret = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAddress,
+				EfiLoaderData, EFI_SIZE_TO_PAGES(size), &addr);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to allocate %ld bytes for the download buffer", size);
+		return ret;
+	}
+
+	dl.data = (VOID *)(UINTN)addr;
+	dl.max_size = size;
+	dl_pages = EFI_SIZE_TO_PAGES(size);
+	debug(L"Download buffer of %ld MiB at 0x%lx", size >> 20, addr);
+
+	return EFI_SUCCESS;
+}
+
 static EFI_STATUS init_download_buffer(void)
 {
 	UINTN size;
 
+	if (!EFI_ERROR(alloc_download_pages()))
+		return EFI_SUCCESS;
+
 	for (size = MAX_DLSIZE; size >= MIN_DLSIZE; size /= 2) {
 		dl.data = AllocatePool(size);
 		if (!dl.data)
@@ -1365,10 +2063,34 @@ static EFI_STATUS fastboot_init()
 	if (EFI_ERROR(ret))
 		goto error;
 
+	ret = fastboot_publish_dynamic("flash-write-size", get_flash_write_size_var);
+	if (EFI_ERROR(ret))
+		goto error;
+
+	ret = fastboot_publish_dynamic("flash-write-align", get_flash_write_align_var);
+	if (EFI_ERROR(ret))
+		goto error;
+
 	ret = fastboot_publish_dynamic("boot-device", get_boot_device_var);
 	if (EFI_ERROR(ret))
 		goto error;
 
+	ret = fastboot_publish_dynamic("transport-rx-bytes", get_transport_rx_bytes_var);
+	if (EFI_ERROR(ret))
+		goto error;
+
+	ret = fastboot_publish_dynamic("transport-tx-bytes", get_transport_tx_bytes_var);
+	if (EFI_ERROR(ret))
+		goto error;
+
+	ret = fastboot_publish_dynamic("transport-rx-rate", get_transport_rx_rate_var);
+	if (EFI_ERROR(ret))
+		goto error;
+
+	ret = fastboot_publish_dynamic("transport-stall", get_transport_stall_var);
+	if (EFI_ERROR(ret))
+		goto error;
+
 	ret = publish_partsize();
 	if (EFI_ERROR(ret))
 		goto error;
@@ -1486,6 +2208,7 @@ EFI_STATUS fastboot_start(void **bootimage, void **efiimage, UINTN *imagesize,
 			goto exit;
 		}
 
+		fastboot_run_stream();
 		fastboot_run_command();
 
 		if (fastboot_state == STATE_STOPPED)
@@ -1541,12 +2264,31 @@ EFI_STATUS fastboot_stop(void *bootimage, void *efiimage, UINTN imagesize,
 
 void fastboot_free()
 {
+	/* The queued writes may still read the download buffer. */
+	stream_abort();
 	if (dl.data) {
-		FreePool(dl.data);
+		if (dl_pages)
+			uefi_call_wrapper(BS->FreePages, 2,
+					  (EFI_PHYSICAL_ADDRESS)(UINTN)dl.data, dl_pages);
+		else
+			FreePool(dl.data);
+		dl_pages = 0;
 		dl.data = NULL;
 		dl.max_size = dl.size = 0;
 	}
 
+	if (stream_label) {
+		FreePool(stream_label);
+		stream_label = NULL;
+	}
+	if (stream_target) {
+		FreePool(stream_target);
+		stream_target = NULL;
+	}
+	dl_streamed = FALSE;
+	stream_local = FALSE;
+
+	tx_ring_free();
 	fastboot_unpublish_all();
 	fastboot_cmdlist_unregister(&cmdlist);
 #ifndef FASTBOOT_FOR_NON_ANDROID
@@ -37,6 +37,7 @@
 #include <vars.h>
 #include <storage.h>
 #include <slot.h>
+#include <transport.h>
 
 #include "uefi_utils.h"
 #include "flash.h"
@@ -50,6 +51,8 @@
 #include "fastboot_flashing.h"
 #include "intel_variables.h"
 #include "text_parser.h"
+#include "timer.h"
+#include "trace.h"
 #include "libavb/libavb.h"
 #include "libavb_user/uefi_avb_ops.h"
 #ifdef USE_TPM
@@ -229,6 +232,24 @@ static void cmd_oem_garbage_disk(__attribute__((__unused__)) INTN argc,
 		fastboot_fail("Garbage disk failed, %r", ret);
 }
 
+static void cmd_oem_flash_stream(INTN argc, CHAR8 **argv)
+{
+	EFI_STATUS ret;
+
+	if (argc > 2) {
+		fastboot_fail("Invalid parameter");
+		return;
+	}
+
+	ret = fastboot_set_flash_stream(argc == 2 ? argv[1] : NULL);
+	if (EFI_ERROR(ret)) {
+		fastboot_fail("Failed to set flash stream, %r", ret);
+		return;
+	}
+
+	fastboot_okay("");
+}
+
 static struct oem_hash {
 	const CHAR16 *name;
 	EFI_STATUS (*hash)(const CHAR16 *name);
@@ -571,6 +592,80 @@ static void cmd_oem_get_logs(INTN argc, __attribute__((__unused__)) CHAR8 **argv
 	fastboot_okay("");
 }
 
+static void transport_stats_info(const char *dir, struct transport_dir_stats *stats)
+{
+	static const char *BUCKETS[TRANSPORT_LATENCY_BUCKETS] = {
+		"<100us", "<1ms", "<10ms", "<100ms", "<1s", ">=1s"
+	};
+	UINT64 rate = 0;
+	UINTN i;
+
+	if (stats->busy_usec)
+		rate = stats->bytes * 1000000 / stats->busy_usec / 1024;
+
+	fastboot_info("%a: %ld bytes, %ld transfers, %ld ms busy, %ld KiB/s",
+		      dir, stats->bytes, stats->transfers,
+		      stats->busy_usec / 1000, rate);
+	for (i = 0; i < ARRAY_SIZE(BUCKETS); i++)
+		if (stats->latency[i])
+			fastboot_info("%a latency %a: %ld", dir, BUCKETS[i],
+				      stats->latency[i]);
+}
+
+static void cmd_oem_transport_stats(INTN argc, CHAR8 **argv)
+{
+	struct transport_stats *stats;
+
+	if (argc > 2 || (argc == 2 && strcmp(argv[1], (CHAR8 *)"reset"))) {
+		fastboot_fail("Invalid parameter");
+		return;
+	}
+
+	stats = transport_get_stats();
+	if (!stats) {
+		fastboot_fail("No transport statistics available");
+		return;
+	}
+
+	if (argc == 2) {
+		transport_reset_stats();
+		fastboot_okay("");
+		return;
+	}
+
+	fastboot_info("transport: %a", transport_get_name());
+	transport_stats_info("rx", &stats->rx);
+	transport_stats_info("tx", &stats->tx);
+	fastboot_info("storage stall: %ld ms", stats->stall_usec / 1000);
+	fastboot_okay("");
+}
+
+static void cmd_oem_boot_trace(INTN argc, __attribute__((__unused__)) CHAR8 **argv)
+{
+	static const char INDENT[] = "                ";
+	const struct trace_span *span;
+	UINTN i, indent;
+
+	if (argc != 1) {
+		fastboot_fail("Invalid parameter");
+		return;
+	}
+
+	for (i = 0; i < trace_count(); i++) {
+		span = trace_get(i);
+		indent = min(span->depth * 2, sizeof(INDENT) - 1);
+		if (span->end)
+			fastboot_info("%a%a: %ld us +%ld us", &INDENT[sizeof(INDENT) - 1 - indent],
+				      span->name, tsc_to_usec(span->begin),
+				      tsc_to_usec(span->end - span->begin));
+		else
+			fastboot_info("%a%a: %ld us (open)", &INDENT[sizeof(INDENT) - 1 - indent],
+				      span->name, tsc_to_usec(span->begin));
+	}
+
+	fastboot_okay("");
+}
+
 static void cmd_oem(INTN argc, CHAR8 **argv)
 {
 	if (argc < 2) {
@@ -723,6 +818,7 @@ static struct fastboot_cmd COMMANDS[] = {
 	{ CRASH_EVENT_MENU,		LOCKED,		cmd_oem_crash_event_menu  },
 	{ "setvar",			UNLOCKED,	cmd_oem_setvar  },
 	{ "garbage-disk",		UNLOCKED,	cmd_oem_garbage_disk  },
+	{ "flash-stream",		UNLOCKED,	cmd_oem_flash_stream  },
 	{ "reboot",			LOCKED,		cmd_oem_reboot  },
 	{ "fw-update",			UNLOCKED,	cmd_oem_fw_update  },
 	{ "set-storage",		LOCKED,		cmd_oem_set_storage  },
@@ -735,6 +831,8 @@ static struct fastboot_cmd COMMANDS[] = {
 #endif
 	{ "get-hashes",			LOCKED,		cmd_oem_gethashes  },
 	{ "get-provisioning-logs",	LOCKED,		cmd_oem_get_logs },
+	{ "transport-stats",		LOCKED,		cmd_oem_transport_stats },
+	{ "boot-trace",			LOCKED,		cmd_oem_boot_trace },
 #ifdef USE_TPM
 #ifndef USER
 	{ "tpm-show-index",		LOCKED,		cmd_oem_tpm_show_index },
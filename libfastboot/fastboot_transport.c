@@ -35,16 +35,17 @@
 #include <fastboot.h>
 #include <usb.h>
 #include <tcp.h>
+#include <udp.h>
 #include <transport.h>
 
+#include "fastboot_udp.h"
+
 /* USB */
 #define FASTBOOT_IF_SUBCLASS		0x42
 #define FASTBOOT_IF_PROTOCOL		0x03
 #define FASTBOOT_STR_CONFIGURATION	L"USB-Update"
 #define FASTBOOT_STR_INTERFACE		L"Fastboot"
 
-static const UINT32 BLK_DOWNLOAD = 8 * 1024 * 1024;
-
 static EFI_STATUS fastboot_usb_start(start_callback_t start_cb,
 				     data_callback_t rx_cb,
 				     data_callback_t tx_cb)
@@ -55,11 +56,6 @@ static EFI_STATUS fastboot_usb_start(start_callback_t start_cb,
 			 start_cb, rx_cb, tx_cb);
 }
 
-EFI_STATUS fastboot_usb_read(void *buf, UINT32 size)
-{
-	return usb_read(buf, min(BLK_DOWNLOAD, size));
-}
-
 /* TCP */
 static const UINT32 TCP_PORT = 5554;
 static const CHAR8 PROTOCOL_VERSION[4] = "FB01";
@@ -172,14 +168,15 @@ static void transport_tcp_tx_cb(void *buf, UINT32 size)
 		tx_callback(buf, size);
 }
 
-static void print_tcpip_information(EFI_IPv4_ADDRESS *address)
+static void print_tcpip_information(const CHAR16 *protocol,
+				    EFI_IPv4_ADDRESS *address, UINT32 port)
 {
-#define TCPIP_INFO_FMT L"Fastboot is listening on TCP %d.%d.%d.%d:%d"
+#define TCPIP_INFO_FMT L"Fastboot is listening on %s %d.%d.%d.%d:%d"
 
-	ui_print(TCPIP_INFO_FMT, address->Addr[0], address->Addr[1],
-		 address->Addr[2], address->Addr[3], TCP_PORT);
-	debug(TCPIP_INFO_FMT, address->Addr[0], address->Addr[1],
-	      address->Addr[2], address->Addr[3], TCP_PORT);
+	ui_print(TCPIP_INFO_FMT, protocol, address->Addr[0], address->Addr[1],
+		 address->Addr[2], address->Addr[3], port);
+	debug(TCPIP_INFO_FMT, protocol, address->Addr[0], address->Addr[1],
+	      address->Addr[2], address->Addr[3], port);
 }
 
 static EFI_STATUS fastboot_tcp_start(start_callback_t start_cb,
@@ -199,32 +196,22 @@ static EFI_STATUS fastboot_tcp_start(start_callback_t start_cb,
 	if (EFI_ERROR(ret))
 		return ret;
 
-	print_tcpip_information(&station_address);
+	print_tcpip_information(L"TCP", &station_address, TCP_PORT);
 
 	return EFI_SUCCESS;
 }
 
 EFI_STATUS fastboot_tcp_write(void *buf, UINT32 size)
 {
-	EFI_STATUS ret;
-	static char write_buf[MAGIC_LENGTH + sizeof(UINT64)];
+	UINT64 header;
 
 	if (tcp_state != READY) {
 		error(L"Inconsistent TCP state %d at write", tcp_state);
 		return EFI_NOT_STARTED;
 	}
 
-	if (size + sizeof(UINT64) > sizeof(write_buf)) {
-		error(L"Invalid size %d", size);
-		return EFI_INVALID_PARAMETER;
-	}
-
-	*((UINT64 *)write_buf) = htobe64(size);
-	ret = memcpy_s(write_buf + sizeof(UINT64), sizeof(write_buf), buf, size);
-	if (EFI_ERROR(ret))
-		return ret;
-
-	return tcp_write(write_buf, size + sizeof(UINT64));
+	header = htobe64(size);
+	return tcp_write_with_header(&header, sizeof(header), buf, size);
 }
 
 EFI_STATUS fastboot_tcp_read(void *buf, UINT32 size)
@@ -248,6 +235,29 @@ EFI_STATUS fastboot_tcp_read(void *buf, UINT32 size)
 	return ret;
 }
 
+#ifdef FASTBOOT_UDP
+/* UDP */
+static const UINT32 UDP_PORT = 5554;
+
+static EFI_STATUS fastboot_udp_start(start_callback_t start_cb,
+				     data_callback_t rx_cb,
+				     data_callback_t tx_cb)
+{
+	EFI_STATUS ret;
+	EFI_IPv4_ADDRESS station_address;
+
+	fastboot_udp_init(udp_send, start_cb, rx_cb, tx_cb);
+	ret = udp_start(UDP_PORT, fastboot_udp_process, &station_address);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	print_tcpip_information(L"UDP", &station_address, UDP_PORT);
+
+	return EFI_SUCCESS;
+}
+
+#endif	/* FASTBOOT_UDP */
+
 /* Transport */
 static transport_t FASTBOOT_TRANSPORT[] = {
 	{
@@ -255,7 +265,7 @@ static transport_t FASTBOOT_TRANSPORT[] = {
 		.start = fastboot_usb_start,
 		.stop = usb_stop,
 		.run = usb_run,
-		.read = fastboot_usb_read,
+		.read = usb_read,
 		.write = usb_write
 	},
 	{
@@ -265,7 +275,17 @@ static transport_t FASTBOOT_TRANSPORT[] = {
 		.run = tcp_run,
 		.read = fastboot_tcp_read,
 		.write = fastboot_tcp_write
+	},
+#ifdef FASTBOOT_UDP
+	{
+		.name = "UDP for fastboot",
+		.start = fastboot_udp_start,
+		.stop = udp_stop,
+		.run = udp_run,
+		.read = fastboot_udp_read,
+		.write = fastboot_udp_write
 	}
+#endif
 };
 
 EFI_STATUS fastboot_transport_register(void)
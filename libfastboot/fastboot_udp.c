@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2022, Intel Corporation
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <lib.h>
+#include <endian.h>
+#include <udp.h>
+
+#include "fastboot_udp.h"
+
+typedef struct udp_header {
+	UINT8 id;
+	UINT8 flags;
+	UINT16 seq;
+} __attribute__((packed)) udp_header_t;
+
+static struct udp_session {
+	fastboot_udp_send_t send;
+	start_callback_t start_callback;
+	data_callback_t rx_callback;
+	data_callback_t tx_callback;
+
+	BOOLEAN started;
+	UINT16 seq;
+	UINT32 packet_size;
+
+	/* Last response, sent again if the host retransmits.  */
+	CHAR8 response[UDP_MAX_DATAGRAM];
+	UINT32 response_size;
+
+	/* Host to device  */
+	char *rx_buf;
+	UINT32 rx_size;
+	UINT32 rx_used;
+	BOOLEAN reading;
+	/* Data received while no read was pending.  */
+	CHAR8 stash[UDP_MAX_DATAGRAM];
+	CHAR8 *pending;
+	UINT32 pending_size;
+	BOOLEAN pending_last;
+
+	/* Device to host  */
+	char *tx_buf;
+	UINT32 tx_size;
+	UINT32 tx_sent;
+	BOOLEAN writing;
+} udp_session;
+
+static EFI_STATUS udp_respond(UINT8 id, UINT8 flags, UINT16 seq,
+			      void *payload, UINT32 size)
+{
+	udp_header_t *header = (udp_header_t *)udp_session.response;
+	EFI_STATUS ret;
+
+	if (size > sizeof(udp_session.response) - UDP_HEADER_SIZE)
+		return EFI_INVALID_PARAMETER;
+
+	header->id = id;
+	header->flags = flags;
+	header->seq = htobe16(seq);
+	if (size) {
+		ret = memcpy_s(udp_session.response + UDP_HEADER_SIZE,
+			       sizeof(udp_session.response) - UDP_HEADER_SIZE,
+			       payload, size);
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+	udp_session.response_size = UDP_HEADER_SIZE + size;
+
+	return udp_session.send(udp_session.response, udp_session.response_size);
+}
+
+static void udp_deliver(void)
+{
+	UINT32 size;
+	EFI_STATUS ret;
+
+	if (!udp_session.reading || !udp_session.pending)
+		return;
+
+	size = min(udp_session.pending_size,
+		   udp_session.rx_size - udp_session.rx_used);
+	ret = memcpy_s(udp_session.rx_buf + udp_session.rx_used,
+		       udp_session.rx_size - udp_session.rx_used,
+		       udp_session.pending, size);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to copy UDP data");
+		return;
+	}
+	udp_session.rx_used += size;
+	udp_session.pending += size;
+	udp_session.pending_size -= size;
+
+	if (udp_session.pending_size == 0) {
+		udp_session.pending = NULL;
+		if (!udp_session.pending_last &&
+		    udp_session.rx_used != udp_session.rx_size)
+			return;
+	} else if (udp_session.rx_used != udp_session.rx_size)
+		return;
+
+	udp_session.reading = FALSE;
+	udp_session.rx_callback(udp_session.rx_buf, udp_session.rx_used);
+}
+
+static void udp_process_fastboot(udp_header_t *header, CHAR8 *payload,
+				 UINT32 size)
+{
+	EFI_STATUS ret;
+	UINT32 chunk = 0;
+	UINT8 flags = 0;
+	BOOLEAN sent = FALSE;
+
+	if (size) {
+		/* The previous packet has not been consumed yet, do
+		   not acknowledge this one so that the host sends it
+		   again later.  */
+		if (udp_session.pending)
+			return;
+
+		udp_session.pending = payload;
+		udp_session.pending_size = size;
+		udp_session.pending_last = !(header->flags & UDP_FLAG_CONTINUATION);
+		udp_deliver();
+
+		if (udp_session.pending) {
+			ret = memcpy_s(udp_session.stash, sizeof(udp_session.stash),
+				       udp_session.pending, udp_session.pending_size);
+			if (EFI_ERROR(ret))
+				return;
+			udp_session.pending = udp_session.stash;
+		}
+	} else if (udp_session.writing) {
+		chunk = min(udp_session.tx_size - udp_session.tx_sent,
+			    udp_session.packet_size - UDP_HEADER_SIZE);
+		if (udp_session.tx_sent + chunk < udp_session.tx_size)
+			flags = UDP_FLAG_CONTINUATION;
+		else
+			sent = TRUE;
+	}
+
+	ret = udp_respond(UDP_ID_FASTBOOT, flags, udp_session.seq,
+			  udp_session.tx_buf + udp_session.tx_sent, chunk);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to send UDP response");
+		return;
+	}
+
+	udp_session.seq++;
+	udp_session.tx_sent += chunk;
+	if (sent) {
+		udp_session.writing = FALSE;
+		udp_session.tx_callback(udp_session.tx_buf, udp_session.tx_size);
+	}
+}
+
+static void udp_process_init(udp_header_t *header, CHAR8 *payload,
+			     UINT32 size)
+{
+	UINT16 data[2];
+	EFI_STATUS ret;
+
+	if (size < sizeof(data)) {
+		error(L"Invalid UDP init packet");
+		return;
+	}
+
+	ret = memcpy_s(data, sizeof(data), payload, sizeof(data));
+	if (EFI_ERROR(ret))
+		return;
+
+	if (be16toh(data[0]) < UDP_PROTOCOL_VERSION ||
+	    be16toh(data[1]) < UDP_MIN_PACKET_SIZE) {
+		udp_respond(UDP_ID_ERROR, 0, be16toh(header->seq),
+			    "Unsupported version or packet size", 34);
+		return;
+	}
+
+	udp_session.packet_size = min((UINT32)be16toh(data[1]),
+				      (UINT32)UDP_MAX_DATAGRAM);
+	udp_session.seq = be16toh(header->seq);
+	udp_session.pending = NULL;
+	udp_session.reading = udp_session.writing = FALSE;
+
+	data[0] = htobe16(UDP_PROTOCOL_VERSION);
+	data[1] = htobe16(udp_session.packet_size);
+	ret = udp_respond(UDP_ID_INIT, 0, udp_session.seq, data, sizeof(data));
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to send UDP init response");
+		return;
+	}
+
+	udp_session.seq++;
+	udp_session.started = TRUE;
+	udp_session.start_callback();
+}
+
+void fastboot_udp_init(fastboot_udp_send_t send_cb,
+		       start_callback_t start_cb,
+		       data_callback_t rx_cb,
+		       data_callback_t tx_cb)
+{
+	memset_s(&udp_session, sizeof(udp_session), 0, sizeof(udp_session));
+	udp_session.send = send_cb;
+	udp_session.start_callback = start_cb;
+	udp_session.rx_callback = rx_cb;
+	udp_session.tx_callback = tx_cb;
+}
+
+void fastboot_udp_process(void *buf, UINT32 size)
+{
+	udp_header_t *header = buf;
+	udp_header_t *last = (udp_header_t *)udp_session.response;
+	UINT16 seq;
+
+	if (size < UDP_HEADER_SIZE)
+		return;
+
+	seq = be16toh(header->seq);
+
+	/* Our response has been lost.  */
+	if (udp_session.response_size && header->id == last->id &&
+	    header->id != UDP_ID_QUERY && seq == be16toh(last->seq)) {
+		udp_session.send(udp_session.response, udp_session.response_size);
+		return;
+	}
+
+	switch (header->id) {
+	case UDP_ID_QUERY: {
+		UINT16 next_seq = htobe16(udp_session.seq);
+
+		udp_respond(UDP_ID_QUERY, 0, seq, &next_seq, sizeof(next_seq));
+		/* Do not replay a query response in place of the init
+		   one.  */
+		udp_session.response_size = 0;
+		return;
+	}
+
+	case UDP_ID_INIT:
+		udp_process_init(header, (CHAR8 *)buf + UDP_HEADER_SIZE,
+				 size - UDP_HEADER_SIZE);
+		return;
+
+	case UDP_ID_FASTBOOT:
+		if (!udp_session.started || seq != udp_session.seq) {
+			debug(L"Unexpected UDP fastboot packet %d", seq);
+			return;
+		}
+		udp_process_fastboot(header, (CHAR8 *)buf + UDP_HEADER_SIZE,
+				     size - UDP_HEADER_SIZE);
+		return;
+
+	default:
+		debug(L"Unknown UDP packet identifier 0x%x", header->id);
+	}
+}
+
+EFI_STATUS fastboot_udp_write(void *buf, UINT32 size)
+{
+	if (!udp_session.started || udp_session.writing)
+		return EFI_NOT_READY;
+
+	udp_session.tx_buf = buf;
+	udp_session.tx_size = size;
+	udp_session.tx_sent = 0;
+	udp_session.writing = TRUE;
+
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS fastboot_udp_read(void *buf, UINT32 size)
+{
+	if (!udp_session.started || udp_session.reading)
+		return EFI_NOT_READY;
+
+	udp_session.rx_buf = buf;
+	udp_session.rx_size = size;
+	udp_session.rx_used = 0;
+	udp_session.reading = TRUE;
+	udp_deliver();
+
+	return EFI_SUCCESS;
+}
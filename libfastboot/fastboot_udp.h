@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2022, Intel Corporation
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _FASTBOOT_UDP_H_
+#define _FASTBOOT_UDP_H_
+
+#include <transport.h>
+
+/* Fastboot over UDP protocol, independent of the network stack so
+   that it can be exercised without one.  */
+
+/* Every packet starts with a 4 bytes header: identifier, flags and a
+   big endian sequence number.  The host sends one packet at a time
+   and retransmits it until it gets the response carrying the same
+   sequence number.  Device data is only sent in the responses to the
+   empty packets the host sends to poll for it.  */
+#define UDP_HEADER_SIZE		4
+#define UDP_ID_ERROR		0x00
+#define UDP_ID_QUERY		0x01
+#define UDP_ID_INIT		0x02
+#define UDP_ID_FASTBOOT		0x03
+#define UDP_FLAG_CONTINUATION	0x01
+#define UDP_PROTOCOL_VERSION	1
+#define UDP_MIN_PACKET_SIZE	512
+
+typedef EFI_STATUS (*fastboot_udp_send_t)(void *buf, UINT32 size);
+
+void fastboot_udp_init(fastboot_udp_send_t send_cb,
+		       start_callback_t start_cb,
+		       data_callback_t rx_cb,
+		       data_callback_t tx_cb);
+/* Handle a datagram received from the host.  */
+void fastboot_udp_process(void *buf, UINT32 size);
+EFI_STATUS fastboot_udp_read(void *buf, UINT32 size);
+EFI_STATUS fastboot_udp_write(void *buf, UINT32 size);
+
+#endif	/* _FASTBOOT_UDP_H_ */
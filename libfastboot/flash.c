@@ -44,7 +44,10 @@
 #include "gpt_bin.h"
 #include "flash.h"
 #include "storage.h"
+#include "aio.h"
+#include "timer.h"
 #include "sparse.h"
+#include "flash_profile.h"
 #include "oemvars.h"
 #include "vars.h"
 #include "bootloader.h"
@@ -78,10 +81,239 @@ EFI_STATUS flash_skip(UINT64 size)
 	return EFI_SUCCESS;
 }
 
-EFI_STATUS flash_write(VOID *data, UINTN size)
+/* Writes are queued on the device of the current partition.  Every
+   public flash operation waits for its writes to complete before
+   returning. */
+static struct aio *flash_aio;
+static EFI_BLOCK_IO *flash_aio_bio;
+
+static EFI_STATUS flash_aio_open(void)
 {
 	EFI_STATUS ret;
 
+	if (flash_aio && flash_aio_bio == gparti.bio)
+		return EFI_SUCCESS;
+
+	ret = aio_close(flash_aio);
+	flash_aio = NULL;
+	if (EFI_ERROR(ret))
+		return ret;
+
+	ret = aio_open(gparti.bio, &flash_aio);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	flash_aio_bio = gparti.bio;
+	return EFI_SUCCESS;
+}
+
+/* All the writes have been waited for at this point. */
+static void flash_aio_close(void)
+{
+	aio_close(flash_aio);
+	flash_aio = NULL;
+}
+
+EFI_STATUS flash_wait(UINT64 seq)
+{
+	EFI_STATUS ret;
+
+	if (!flash_aio)
+		return EFI_SUCCESS;
+
+	flash_profile_begin(FLASH_STAGE_WRITE);
+	ret = aio_wait(flash_aio, seq);
+	flash_profile_end(FLASH_STAGE_WRITE, 0);
+
+	return ret;
+}
+
+EFI_STATUS flash_sync(void)
+{
+	EFI_STATUS ret;
+
+	if (!flash_aio)
+		return EFI_SUCCESS;
+
+	flash_profile_begin(FLASH_STAGE_WRITE);
+	ret = aio_flush(flash_aio);
+	flash_profile_end(FLASH_STAGE_WRITE, 0);
+
+	return ret;
+}
+
+/* Transfer sizes measured over the first writes of a session for
+   each storage type.  The fastest one is then used to split the
+   writes.  Each candidate writes CALIBRATION_SIZE bytes. */
+static const UINTN WRITE_SIZES[] = {
+	256 * 1024, 1024 * 1024, 4 * 1024 * 1024, 16 * 1024 * 1024
+};
+#define CALIBRATION_SIZE (32 * 1024 * 1024)
+#define DEFAULT_WRITE_SIZE (4 * 1024 * 1024)
+
+static struct write_tuning {
+	BOOLEAN calibrated;
+	UINTN size;
+	UINTN align;
+	UINT32 rate[ARRAY_SIZE(WRITE_SIZES)];	/* MB/s */
+	/* Measurement in progress, carried over consecutive writes to
+	   the partition starting at CAL_PART. */
+	UINT64 cal_part;
+	UINTN cal_index;
+	UINT64 cal_done;
+	UINT64 cal_usec;
+} write_tuning[STORAGE_ALL];
+
+static UINTN align_write_size(struct write_tuning *t, UINTN size)
+{
+	if (!t->align)
+		return size;
+	return ((size + t->align - 1) / t->align) * t->align;
+}
+
+/* The erase block size is the lower bound of the transfer
+   granularity.  Both it and the alignment are in bytes, an erase
+   block size which is not a multiple of the logical block size is
+   not used. */
+static struct write_tuning *get_write_tuning(void)
+{
+	EFI_STATUS ret;
+	enum storage_type type;
+	struct write_tuning *t;
+	UINTN erase_blk_size, blk_sz;
+
+	ret = get_boot_device_type(&type);
+	if (EFI_ERROR(ret) || type >= STORAGE_ALL)
+		return NULL;
+
+	t = &write_tuning[type];
+	if (t->size)
+		return t;
+
+	ret = storage_get_erase_block_size(&erase_blk_size);
+	if (!EFI_ERROR(ret))
+		ret = get_logical_block_size(&blk_sz);
+	t->align = EFI_ERROR(ret) || !blk_sz || erase_blk_size % blk_sz ?
+		0 : erase_blk_size;
+	t->size = align_write_size(t, DEFAULT_WRITE_SIZE);
+
+	return t;
+}
+
+EFI_STATUS flash_get_write_tuning(UINTN *size, UINTN *align)
+{
+	struct write_tuning *t;
+
+	if (!size || !align)
+		return EFI_INVALID_PARAMETER;
+
+	t = get_write_tuning();
+	if (!t)
+		return EFI_UNSUPPORTED;
+
+	*size = t->size;
+	*align = t->align;
+	return EFI_SUCCESS;
+}
+
+/* Write the beginning of DATA with the WRITE_SIZES candidate being
+   measured.  The measurement goes on over the next writes to the
+   same partition until every candidate has written CALIBRATION_SIZE
+   bytes, the fastest one is then kept. */
+static EFI_STATUS calibrate_write_size(struct write_tuning *t, CHAR8 **data, UINTN *size)
+{
+	EFI_STATUS ret;
+	UINTN i, best = 0, len, blk_sz = gparti.bio->Media->BlockSize;
+	UINT64 start;
+
+	if (t->cal_part != part_start) {
+		t->cal_part = part_start;
+		t->cal_index = 0;
+		t->cal_done = 0;
+		t->cal_usec = 0;
+	}
+
+	while (*size && t->cal_index < ARRAY_SIZE(WRITE_SIZES)) {
+		len = align_write_size(t, WRITE_SIZES[t->cal_index]);
+		start = boottime_in_usec();
+		for (; t->cal_done < CALIBRATION_SIZE && *size; t->cal_done += len) {
+			len = min(len, *size);
+			ret = aio_write(flash_aio, cur_offset / blk_sz, len, *data, NULL);
+			if (EFI_ERROR(ret))
+				return ret;
+			cur_offset += len;
+			*data += len;
+			*size -= len;
+		}
+		ret = aio_flush(flash_aio);
+		if (EFI_ERROR(ret))
+			return ret;
+		t->cal_usec += boottime_in_usec() - start;
+
+		if (t->cal_done < CALIBRATION_SIZE)
+			return EFI_SUCCESS;
+
+		i = t->cal_index++;
+		t->rate[i] = t->cal_done * 1000000 / max(t->cal_usec, (UINT64)1) / (1024 * 1024);
+		debug(L"Write size %ld: %d MB/s", WRITE_SIZES[i], t->rate[i]);
+		t->cal_done = 0;
+		t->cal_usec = 0;
+	}
+
+	if (t->cal_index < ARRAY_SIZE(WRITE_SIZES))
+		return EFI_SUCCESS;
+
+	for (i = 1; i < ARRAY_SIZE(WRITE_SIZES); i++)
+		if (t->rate[i] > t->rate[best])
+			best = i;
+
+	t->size = align_write_size(t, WRITE_SIZES[best]);
+	t->calibrated = TRUE;
+	debug(L"Selected write size %ld", t->size);
+
+	return EFI_SUCCESS;
+}
+
+UINT32 flash_io_align(void)
+{
+	return gparti.bio ? gparti.bio->Media->IoAlign : 0;
+}
+
+static BOOLEAN is_io_aligned(VOID *data)
+{
+	UINT32 align = flash_io_align();
+
+	return align <= 1 || !((UINTN)data & (align - 1));
+}
+
+/* Write through the DiskIo protocol which takes care of partial
+   blocks and of buffers which do not meet the IoAlign requirement of
+   the BlockIo layer. */
+static EFI_STATUS write_sync(VOID *data, UINTN size)
+{
+	EFI_STATUS ret;
+
+	ret = flash_sync();
+	if (EFI_ERROR(ret))
+		return ret;
+
+	ret = uefi_call_wrapper(gparti.dio->WriteDisk, 5, gparti.dio, gparti.bio->Media->MediaId, cur_offset, size, data);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to write bytes");
+		return ret;
+	}
+
+	cur_offset += size;
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS write_async(VOID *data, UINTN size, UINT64 *seq)
+{
+	EFI_STATUS ret;
+	struct write_tuning *t;
+	CHAR8 *p = data;
+	UINTN blk_sz, write_size, len;
+
 	if (!gparti.bio)
 		return EFI_INVALID_PARAMETER;
 
@@ -90,19 +322,177 @@ EFI_STATUS flash_write(VOID *data, UINTN size)
 				part_start, part_end, cur_offset, cur_offset + size);
 		return EFI_INVALID_PARAMETER;
 	}
-	ret = uefi_call_wrapper(gparti.dio->WriteDisk, 5, gparti.dio, gparti.bio->Media->MediaId, cur_offset, size, data);
+
+	ret = flash_aio_open();
+	if (EFI_ERROR(ret))
+		return ret;
+
+	if (seq)
+		*seq = 0;
+
+	blk_sz = gparti.bio->Media->BlockSize;
+	if (cur_offset % blk_sz || size % blk_sz || !is_io_aligned(data))
+		return write_sync(data, size);
+
+	t = get_write_tuning();
+	if (t && !t->calibrated && get_cpu_freq()) {
+		ret = calibrate_write_size(t, &p, &size);
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+
+	/* Split the write in transfers aligned on the write size.  A
+	   piece may not meet the DMA alignment if the block size is not
+	   a multiple of it: let the DiskIo layer bounce it.  */
+	write_size = t ? t->size : 0;
+	for (; size; size -= len, p += len) {
+		len = size;
+		if (write_size)
+			len = min(len, write_size - (UINTN)(cur_offset % write_size));
+		if (!is_io_aligned(p)) {
+			ret = write_sync(p, len);
+			if (EFI_ERROR(ret))
+				return ret;
+			continue;
+		}
+		ret = aio_write(flash_aio, cur_offset / blk_sz, len, p, seq);
+		if (EFI_ERROR(ret))
+			return ret;
+		cur_offset += len;
+	}
+
+	return EFI_SUCCESS;
+}
+
+/* DATA must not be modified until flash_wait(*SEQ) or flash_sync()
+   has been called. */
+EFI_STATUS flash_write_async(VOID *data, UINTN size, UINT64 *seq)
+{
+	EFI_STATUS ret;
+
+	flash_profile_begin(FLASH_STAGE_WRITE);
+	ret = write_async(data, size, seq);
+	flash_profile_end(FLASH_STAGE_WRITE, EFI_ERROR(ret) ? 0 : size);
+
+	return ret;
+}
+
+EFI_STATUS flash_write(VOID *data, UINTN size)
+{
+	EFI_STATUS ret;
+	UINT64 seq;
+
+	ret = flash_write_async(data, size, &seq);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	return flash_wait(seq);
+}
+
+/* Zero and all-ones FILL chunks are handed over to the storage erase
+   operation (Write Zeroes, eMMC/UFS erase, ...) when they are at least
+   this large.  An erase has a fixed cost which only pays off for large
+   chunks: eMMC polls the erase completion every second.  */
+static UINT64 erase_fill_threshold(void)
+{
+	enum storage_type type;
+
+	if (!EFI_ERROR(get_boot_device_type(&type)) && type == STORAGE_EMMC)
+		return 512 * MiB;
+
+	return 256 * MiB;
+}
+
+/* What the storage erase operation produces is device specific and
+   sometimes indeterminate.  Once the read back check failed for a
+   pattern, it is not tried again for this pattern.  */
+static BOOLEAN erase_fill_broken[2];
+
+static BOOLEAN is_block_filled_with(EFI_LBA lba, UINT32 pattern, UINT32 *block)
+{
+	EFI_STATUS ret;
+	UINTN i;
+
+	ret = uefi_call_wrapper(gparti.bio->ReadBlocks, 5, gparti.bio,
+				gparti.bio->Media->MediaId, lba,
+				gparti.bio->Media->BlockSize, block);
 	if (EFI_ERROR(ret)) {
-		efi_perror(ret, L"Failed to write bytes");
+		efi_perror(ret, L"Failed to read block %ld", lba);
+		return FALSE;
+	}
+
+	for (i = 0; i < gparti.bio->Media->BlockSize / sizeof(*block); i++)
+		if (block[i] != pattern)
+			return FALSE;
+
+	return TRUE;
+}
+
+static EFI_STATUS erase_fill(UINT32 pattern, UINTN size)
+{
+	EFI_STATUS ret;
+	EFI_LBA start, end, lba, step;
+	UINT32 *aligned_block;
+	VOID *block;
+	UINTN erase_blk_size, blk_sz = gparti.bio->Media->BlockSize;
+	BOOLEAN filled, *broken = &erase_fill_broken[pattern ? 1 : 0];
+
+	if (*broken || cur_offset % blk_sz)
+		return EFI_UNSUPPORTED;
+
+	ret = flash_sync();
+	if (EFI_ERROR(ret))
 		return ret;
+
+	if (!is_inside_partition(cur_offset, size)) {
+		error(L"Attempt to fill outside of partition [%ld %ld] [%ld %ld]",
+				part_start, part_end, cur_offset, cur_offset + size);
+		return EFI_INVALID_PARAMETER;
+	}
+
+	start = cur_offset / blk_sz;
+	end = start + size / blk_sz - 1;
+	ret = storage_erase_blocks(gparti.handle, gparti.bio, start, end);
+	if (EFI_ERROR(ret)) {
+		/* Do not try again on each chunk. */
+		if (ret != EFI_UNSUPPORTED)
+			efi_perror(ret, L"Failed to erase blocks %ld-%ld", start, end);
+		*broken = TRUE;
+		return EFI_UNSUPPORTED;
+	}
+
+	/* Erased blocks only read back as PATTERN if the device erases
+	   to it.  That may differ from an erase group to the other, for
+	   instance when unmapped groups read as zeros but others keep
+	   stale data: check one block of each erase group, and the last
+	   block as storage_erase_blocks() may have written the unaligned
+	   ends itself. */
+	ret = alloc_aligned(&block, (VOID **)&aligned_block, blk_sz, gparti.bio->Media->IoAlign);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	ret = storage_get_erase_block_size(&erase_blk_size);
+	step = EFI_ERROR(ret) || erase_blk_size < blk_sz ? N_BLOCK : erase_blk_size / blk_sz;
+	for (lba = start; lba <= end; lba += step)
+		if (!is_block_filled_with(lba, pattern, aligned_block))
+			break;
+	filled = lba > end && is_block_filled_with(end, pattern, aligned_block);
+	FreePool(block);
+
+	if (!filled) {
+		debug(L"Erased blocks do not match the %08x pattern", pattern);
+		*broken = TRUE;
+		return EFI_UNSUPPORTED;
 	}
 
 	cur_offset += size;
 	return EFI_SUCCESS;
 }
 
-EFI_STATUS flash_fill(UINT32 pattern, UINTN size)
+static EFI_STATUS fill(UINT32 pattern, UINTN size)
 {
-	EFI_STATUS ret;
+	EFI_STATUS ret, ret_sync;
+	struct write_tuning *t;
 	UINT32 *aligned_buf;
 	VOID *buf;
 	UINTN i, buf_size, write_size;
@@ -110,7 +500,16 @@ EFI_STATUS flash_fill(UINT32 pattern, UINTN size)
 	if (!gparti.bio || !size || size % gparti.bio->Media->BlockSize)
 		return EFI_INVALID_PARAMETER;
 
-	buf_size = min(gparti.bio->Media->BlockSize * N_BLOCK, size);
+	if ((pattern == 0 || pattern == 0xFFFFFFFF) &&
+	    size >= erase_fill_threshold()) {
+		ret = erase_fill(pattern, size);
+		if (ret != EFI_UNSUPPORTED)
+			return ret;
+		debug(L"Fallbacking to writing the %08x pattern", pattern);
+	}
+
+	t = get_write_tuning();
+	buf_size = min(t ? t->size : gparti.bio->Media->BlockSize * N_BLOCK, size);
 	ret = alloc_aligned(&buf, (VOID **)&aligned_buf, buf_size, gparti.bio->Media->IoAlign);
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Unable to allocate the pattern buf");
@@ -122,13 +521,27 @@ EFI_STATUS flash_fill(UINT32 pattern, UINTN size)
 
 	for (; size; size -= write_size) {
 		write_size = min(size, buf_size);
-		ret = flash_write(aligned_buf, write_size);
+		ret = flash_write_async(aligned_buf, write_size, NULL);
 		if (EFI_ERROR(ret))
 			goto out;
 	}
 
 out:
+	ret_sync = flash_sync();
 	FreePool(buf);
+	return EFI_ERROR(ret) ? ret : ret_sync;
+}
+
+/* Pattern writes are accounted to the write stage, the fill stage
+   only covers the erase operation and the buffer preparation. */
+EFI_STATUS flash_fill(UINT32 pattern, UINTN size)
+{
+	EFI_STATUS ret;
+
+	flash_profile_begin(FLASH_STAGE_FILL);
+	ret = fill(pattern, size);
+	flash_profile_end(FLASH_STAGE_FILL, EFI_ERROR(ret) ? 0 : size);
+
 	return ret;
 }
 
@@ -435,11 +848,30 @@ static EFI_STATUS flash_ramdisk(VOID *data, UINTN size)
 static CHAR16 *DM_VERITY_PARTITIONS[] =
 	{ SYSTEM_LABEL, VENDOR_LABEL, OEM_LABEL };
 
-EFI_STATUS flash_partition(VOID *data, UINTN size, CHAR16 *label)
+static EFI_STATUS flash_partition_done(CHAR16 *label)
 {
 	EFI_STATUS ret;
 	UINTN i;
 
+	if (!CompareGuid(&gparti.part.type, &EfiPartTypeSystemPartitionGuid)) {
+		flash_profile_begin(FLASH_STAGE_GPT);
+		ret = gpt_refresh();
+		flash_profile_end(FLASH_STAGE_GPT, 0);
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(DM_VERITY_PARTITIONS); i++)
+		if (!StrCmp(DM_VERITY_PARTITIONS[i], label))
+			return slot_set_verity_corrupted(FALSE);
+
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS flash_partition(VOID *data, UINTN size, CHAR16 *label)
+{
+	EFI_STATUS ret;
+
 	ret = gpt_get_partition_by_label(label, &gparti, LOGICAL_UNIT_USER);
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Failed to get partition %s", label);
@@ -456,17 +888,7 @@ EFI_STATUS flash_partition(VOID *data, UINTN size, CHAR16 *label)
 	if (EFI_ERROR(ret))
 		return ret;
 
-	if (!CompareGuid(&gparti.part.type, &EfiPartTypeSystemPartitionGuid)) {
-		ret = gpt_refresh();
-		if (EFI_ERROR(ret))
-			return ret;
-	}
-
-	for (i = 0; i < ARRAY_SIZE(DM_VERITY_PARTITIONS); i++)
-		if (!StrCmp(DM_VERITY_PARTITIONS[i], label))
-			return slot_set_verity_corrupted(FALSE);
-
-	return EFI_SUCCESS;
+	return flash_partition_done(label);
 }
 
 static struct label_exception {
@@ -498,6 +920,7 @@ static struct label_exception {
 
 EFI_STATUS flash(VOID *data, UINTN size, CHAR16 *label)
 {
+	EFI_STATUS ret;
 	UINTN i;
 
 #ifndef USER
@@ -507,11 +930,121 @@ EFI_STATUS flash(VOID *data, UINTN size, CHAR16 *label)
 		return flash_into_esp(data, size, &label[ARRAY_SIZE(esp) - 1]);
 #endif
 	/* special cases */
+	for (i = 0; i < ARRAY_SIZE(LABEL_EXCEPTIONS); i++)
+		if (!StrCmp(LABEL_EXCEPTIONS[i].name, label)) {
+			ret = LABEL_EXCEPTIONS[i].flash_func(data, size);
+			goto out;
+		}
+
+	ret = flash_partition(data, size, label);
+
+out:
+	flash_aio_close();
+	return ret;
+}
+
+static enum {
+	STREAM_CLOSED,
+	STREAM_DETECT,
+	STREAM_RAW,
+	STREAM_SPARSE
+} stream_mode;
+static struct sparse_stream stream;
+
+/* Streaming flash writes a partition image while it is still being
+   received.  Only regular partitions are supported: the special
+   labels need the complete image before doing anything. */
+EFI_STATUS flash_stream_open(CHAR16 *label)
+{
+	EFI_STATUS ret;
+	UINTN i;
+
+	flash_stream_abort();
+
+	if (!StrnCmp(L"/ESP/", label, StrLen(L"/ESP/")))
+		return EFI_UNSUPPORTED;
+
 	for (i = 0; i < ARRAY_SIZE(LABEL_EXCEPTIONS); i++)
 		if (!StrCmp(LABEL_EXCEPTIONS[i].name, label))
-			return LABEL_EXCEPTIONS[i].flash_func(data, size);
+			return EFI_UNSUPPORTED;
+
+	ret = gpt_get_partition_by_label(label, &gparti, LOGICAL_UNIT_USER);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to get partition %s", label);
+		return ret;
+	}
+
+	cur_offset = gparti.part.starting_lba * gparti.bio->Media->BlockSize;
+	stream_mode = STREAM_DETECT;
+
+	return EFI_SUCCESS;
+}
+
+/* The first write must include the complete sparse header, if any,
+   for the image format to be detected. */
+EFI_STATUS flash_stream_write(VOID *data, UINTN size)
+{
+	EFI_STATUS ret;
+
+	if (stream_mode == STREAM_DETECT) {
+		if (is_sparse_image(data, size)) {
+			ret = sparse_stream_init(&stream);
+			if (EFI_ERROR(ret))
+				return ret;
+			stream_mode = STREAM_SPARSE;
+		} else
+			stream_mode = STREAM_RAW;
+	}
+
+	switch (stream_mode) {
+	case STREAM_RAW:
+		return flash_write(data, size);
+	case STREAM_SPARSE:
+		return sparse_stream_feed(&stream, data, size);
+	default:
+		return EFI_NOT_STARTED;
+	}
+}
+
+EFI_STATUS flash_stream_close(CHAR16 *label)
+{
+	EFI_STATUS ret = EFI_SUCCESS;
+
+	switch (stream_mode) {
+	case STREAM_CLOSED:
+		return EFI_NOT_STARTED;
+	case STREAM_SPARSE:
+		ret = sparse_stream_finish(&stream);
+		break;
+	default:
+		break;
+	}
+
+	stream_mode = STREAM_CLOSED;
+	flash_aio_close();
+	if (EFI_ERROR(ret))
+		return ret;
+
+	return flash_partition_done(label);
+}
+
+/* Forget a stream which will not be closed, such as the one of an
+   interrupted download.  What has been written is left as is. */
+void flash_stream_abort(void)
+{
+	switch (stream_mode) {
+	case STREAM_CLOSED:
+		return;
+	case STREAM_SPARSE:
+		sparse_stream_abort(&stream);
+		break;
+	default:
+		flash_sync();
+		break;
+	}
 
-	return flash_partition(data, size, label);
+	stream_mode = STREAM_CLOSED;
+	flash_aio_close();
 }
 
 EFI_STATUS flash_file(EFI_HANDLE image, CHAR16 *filename, CHAR16 *label)
@@ -41,7 +41,12 @@ extern BOOLEAN new_install_device;
 
 EFI_STATUS flash_skip(UINT64 size);
 EFI_STATUS flash_write(VOID *data, UINTN size);
+EFI_STATUS flash_write_async(VOID *data, UINTN size, UINT64 *seq);
+EFI_STATUS flash_wait(UINT64 seq);
+EFI_STATUS flash_sync(void);
 EFI_STATUS flash_fill(UINT32 pattern, UINTN size);
+UINT32 flash_io_align(void);
+EFI_STATUS flash_get_write_tuning(UINTN *size, UINTN *align);
 
 /* return value for flash() function */
 
@@ -54,4 +59,9 @@ EFI_STATUS garbage_disk(void);
 EFI_STATUS flash_partition(VOID *data, UINTN size, CHAR16 *label);
 EFI_STATUS fill_zero(EFI_BLOCK_IO *bio, UINT64 start, UINT64 end);
 
+EFI_STATUS flash_stream_open(CHAR16 *label);
+EFI_STATUS flash_stream_write(VOID *data, UINTN size);
+EFI_STATUS flash_stream_close(CHAR16 *label);
+void flash_stream_abort(void);
+
 #endif	/* _FLASH_H_ */
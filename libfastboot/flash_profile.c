@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2022, Intel Corporation
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <efi.h>
+#include <efilib.h>
+#include <lib.h>
+#include "fastboot.h"
+#include "timer.h"
+#include "flash_profile.h"
+
+static const char *STAGE_NAMES[FLASH_STAGE_LAST] = {
+	[FLASH_STAGE_DOWNLOAD] = "download",
+	[FLASH_STAGE_SPARSE] = "sparse",
+	[FLASH_STAGE_COPY] = "copy",
+	[FLASH_STAGE_WRITE] = "write",
+	[FLASH_STAGE_FILL] = "fill",
+	[FLASH_STAGE_SYNC] = "sync",
+	[FLASH_STAGE_GPT] = "gpt"
+};
+
+#define MAX_DEPTH 8
+
+static struct stage_profile {
+	UINT64 usec;
+	UINT64 bytes;
+	UINT64 count;
+} stages[FLASH_STAGE_LAST];
+
+static enum flash_stage stack[MAX_DEPTH];
+static UINTN depth;
+static UINTN overflow;
+static UINT64 start;
+static UINT64 last;
+
+/* Account the time elapsed since the last event to the innermost
+   running stage. */
+static void account(UINT64 now)
+{
+	if (depth)
+		stages[stack[depth - 1]].usec += now - last;
+	last = now;
+}
+
+void flash_profile_reset(void)
+{
+	ZeroMem(stages, sizeof(stages));
+	depth = overflow = 0;
+	start = last = boottime_in_usec();
+}
+
+void flash_profile_begin(enum flash_stage stage)
+{
+	if (stage >= FLASH_STAGE_LAST)
+		return;
+
+	if (depth == MAX_DEPTH) {
+		overflow++;
+		return;
+	}
+
+	account(boottime_in_usec());
+	stack[depth++] = stage;
+	stages[stage].count++;
+}
+
+void flash_profile_end(enum flash_stage stage, UINT64 bytes)
+{
+	if (stage >= FLASH_STAGE_LAST)
+		return;
+
+	if (overflow) {
+		overflow--;
+		return;
+	}
+
+	if (!depth || stack[depth - 1] != stage) {
+		debug(L"Unbalanced %a flash profile stage", STAGE_NAMES[stage]);
+		return;
+	}
+
+	account(boottime_in_usec());
+	stages[stage].bytes += bytes;
+	depth--;
+}
+
+/* One JSON object per INFO line so that each line can be parsed on
+   its own: the total first, then the stages that ran. */
+void flash_profile_report(void)
+{
+	UINTN i;
+
+	fastboot_info("{\"profile\":\"flash\",\"ms\":%ld}",
+		      (boottime_in_usec() - start) / 1000);
+
+	for (i = 0; i < FLASH_STAGE_LAST; i++) {
+		if (!stages[i].count)
+			continue;
+		fastboot_info("{\"stage\":\"%a\",\"ms\":%ld,\"bytes\":%ld}",
+			      STAGE_NAMES[i], stages[i].usec / 1000,
+			      stages[i].bytes);
+	}
+}
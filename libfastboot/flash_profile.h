@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2022, Intel Corporation
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _FLASH_PROFILE_H_
+#define _FLASH_PROFILE_H_
+
+#include <efi.h>
+
+/* Stages of a flash command.  Stages nest: the time spent in a stage
+   begun while another one is running is only accounted to the inner
+   one. */
+enum flash_stage {
+	FLASH_STAGE_DOWNLOAD,
+	FLASH_STAGE_SPARSE,
+	FLASH_STAGE_COPY,
+	FLASH_STAGE_WRITE,
+	FLASH_STAGE_FILL,
+	FLASH_STAGE_SYNC,
+	FLASH_STAGE_GPT,
+	FLASH_STAGE_LAST
+};
+
+void flash_profile_reset(void);
+void flash_profile_begin(enum flash_stage stage);
+void flash_profile_end(enum flash_stage stage, UINT64 bytes);
+void flash_profile_report(void);
+
+#endif	/* _FLASH_PROFILE_H_ */
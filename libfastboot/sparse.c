@@ -38,15 +38,19 @@
 #include "uefi_utils.h"
 
 #include "flash.h"
-#include "sparse_format.h"
+#include "sparse.h"
+#include "flash_profile.h"
 
-/* Hunks buffer size.  */
+/* Hunks buffer size.  The buffer is split in two halves: one is
+   filled while the other one is being written.  */
 static const unsigned int BUFFER_SIZE = 10 * 1024 * 1024;
-/* Hunks that are larger than this threshold won't be buffered.  This
-   threshold MUST be smaller than the buffer size.  */
-static const unsigned int HUNK_SIZE_THRESHOLD = 1024 * 1024;
-static void *buffer;
-static unsigned int cur_size;
+/* Hunks that are larger than this threshold are written in place,
+   without being copied, if they satisfy the device DMA alignment.
+   Below, the per-command cost outweighs the copy.  */
+static const unsigned int DIRECT_SIZE_THRESHOLD = 64 * 1024;
+static void *buffer, *buffer_alloc, *cur_buffer;
+static unsigned int cur_size, cur_half;
+static UINT64 half_seq[2];
 
 BOOLEAN is_sparse_image(void *data, UINT64 size)
 {
@@ -77,13 +81,18 @@ BOOLEAN is_sparse_image(void *data, UINT64 size)
 
 static EFI_STATUS init_buffer()
 {
-	buffer = AllocatePool(BUFFER_SIZE);
-	if (!buffer) {
+	EFI_STATUS ret;
+
+	ret = alloc_aligned(&buffer_alloc, &buffer, BUFFER_SIZE, flash_io_align());
+	if (EFI_ERROR(ret)) {
 		debug(L"Allocation failed, sparse file buffer is disabled");
-		return EFI_OUT_OF_RESOURCES;
+		buffer = NULL;
+		return ret;
 	}
 
-	cur_size = 0;
+	cur_buffer = buffer;
+	cur_size = cur_half = 0;
+	half_seq[0] = half_seq[1] = 0;
 	return EFI_SUCCESS;
 }
 
@@ -92,120 +101,508 @@ static void free_buffer()
 	if (!buffer)
 		return;
 
-	FreePool(buffer);
-	buffer = NULL;
+	FreePool(buffer_alloc);
+	buffer = buffer_alloc = cur_buffer = NULL;
 }
 
 static EFI_STATUS flush_buffer()
 {
-	EFI_STATUS ret = EFI_SUCCESS;
+	EFI_STATUS ret;
 
-	if (buffer && cur_size != 0)
-		ret = flash_write(buffer, cur_size);
+	if (!buffer || cur_size == 0)
+		return EFI_SUCCESS;
 
+	ret = flash_write_async(cur_buffer, cur_size, &half_seq[cur_half]);
 	cur_size = 0;
-	return ret;
+	if (EFI_ERROR(ret))
+		return ret;
+
+	/* Switch to the other half once its write has completed. */
+	cur_half ^= 1;
+	cur_buffer = buffer + cur_half * (BUFFER_SIZE / 2);
+	return flash_wait(half_seq[cur_half]);
 }
 
-static EFI_STATUS flash_raw_data(void *data, unsigned size)
+static BOOLEAN is_io_aligned(void *data)
+{
+	UINT32 align = flash_io_align();
+
+	return align <= 1 || !((UINTN)data & (align - 1));
+}
+
+/* RAW chunks sit in the download buffer right after their header:
+   write them from there unless they are small or do not satisfy the
+   device DMA alignment, in which case they are bounced through our
+   own aligned buffer, half a buffer at a time.  IN_PLACE data stays
+   valid until the end of the current feed call and can be written
+   asynchronously.  */
+static EFI_STATUS flash_raw_data(void *data, unsigned size, BOOLEAN in_place)
 {
 	EFI_STATUS ret;
+	unsigned len;
 
 	if (!buffer)
 		return flash_write(data, size);
 
-	if (size > HUNK_SIZE_THRESHOLD) {
+	if (size >= DIRECT_SIZE_THRESHOLD && is_io_aligned(data)) {
 		ret = flush_buffer();
 		if (EFI_ERROR(ret))
 			return ret;
+		if (in_place)
+			return flash_write_async(data, size, NULL);
 		return flash_write(data, size);
 	}
 
-	if (size + cur_size > BUFFER_SIZE) {
-		ret = flush_buffer();
+	for (; size; size -= len, data += len) {
+		len = min(size, BUFFER_SIZE / 2);
+		if (len + cur_size > BUFFER_SIZE / 2) {
+			ret = flush_buffer();
+			if (EFI_ERROR(ret))
+				return ret;
+		}
+
+		flash_profile_begin(FLASH_STAGE_COPY);
+		ret = memcpy_s(cur_buffer + cur_size, len, data, len);
+		flash_profile_end(FLASH_STAGE_COPY, len);
 		if (EFI_ERROR(ret))
 			return ret;
+
+		cur_size += len;
 	}
 
-	ret = memcpy_s(buffer + cur_size, size, data, size);
-	if (EFI_ERROR(ret))
-		return ret;
+	return EFI_SUCCESS;
+}
 
-	cur_size += size;
+/* CRC32 (IEEE 802.3, reflected polynomial 0xEDB88320) of the
+   expanded image, as expected by CHUNK_TYPE_CRC32 chunks.  RAW data
+   uses a slice-by-8 table; FILL and DONT_CARE chunks are folded in
+   with GF(2) matrix operators so that their cost only depends on the
+   logarithm of the chunk size. */
+#define CRC32_POLY 0xEDB88320
 
-	return EFI_SUCCESS;
+static UINT32 crc32_table[8][256];
+static BOOLEAN crc32_table_ready;
+
+static void crc32_init_table(void)
+{
+	UINT32 c, i, j;
+
+	if (crc32_table_ready)
+		return;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = c & 1 ? (c >> 1) ^ CRC32_POLY : c >> 1;
+		crc32_table[0][i] = c;
+	}
+	for (i = 0; i < 256; i++)
+		for (j = 1; j < 8; j++)
+			crc32_table[j][i] = (crc32_table[j - 1][i] >> 8) ^
+				crc32_table[0][crc32_table[j - 1][i] & 0xff];
+
+	crc32_table_ready = TRUE;
+}
+
+/* Update the raw (non-inverted) CRC register with DATA. */
+static UINT32 crc32_raw(UINT32 c, const void *data, UINTN len)
+{
+	const UINT8 *p = data;
+	UINT64 w;
+
+	for (; len && ((UINTN)p & 7); len--)
+		c = crc32_table[0][(c ^ *p++) & 0xff] ^ (c >> 8);
+
+	for (; len >= 8; len -= 8, p += 8) {
+		w = *(const UINT64 *)p ^ c;
+		c = crc32_table[7][w & 0xff] ^
+			crc32_table[6][(w >> 8) & 0xff] ^
+			crc32_table[5][(w >> 16) & 0xff] ^
+			crc32_table[4][(w >> 24) & 0xff] ^
+			crc32_table[3][(w >> 32) & 0xff] ^
+			crc32_table[2][(w >> 40) & 0xff] ^
+			crc32_table[1][(w >> 48) & 0xff] ^
+			crc32_table[0][w >> 56];
+	}
+
+	while (len--)
+		c = crc32_table[0][(c ^ *p++) & 0xff] ^ (c >> 8);
+
+	return c;
+}
+
+static UINT32 gf2_matrix_times(const UINT32 *mat, UINT32 vec)
+{
+	UINT32 sum = 0;
+
+	for (; vec; vec >>= 1, mat++)
+		if (vec & 1)
+			sum ^= *mat;
+
+	return sum;
+}
+
+static void gf2_matrix_square(UINT32 *square, const UINT32 *mat)
+{
+	UINTN n;
+
+	for (n = 0; n < 32; n++)
+		square[n] = gf2_matrix_times(mat, mat[n]);
 }
 
-static EFI_STATUS flash_chunk(struct sparse_header *sph, struct chunk_header *ckh, CHAR8 *data, unsigned int size)
+/* Update the CRC as if the 32 bits PATTERN was repeated to fill LEN
+   bytes.  LEN must be a multiple of 4. */
+static UINT32 crc32_fill(UINT32 crc, UINT32 pattern, UINT64 len)
+{
+	UINT32 mat[32], square[32], unit, c = ~crc;
+	UINT64 count = len / sizeof(pattern);
+	UINTN n;
+
+	/* Operator for one zero bit, squared up to one pattern. */
+	mat[0] = CRC32_POLY;
+	for (n = 1; n < 32; n++)
+		mat[n] = 1U << (n - 1);
+	for (n = 0; n < 5; n++) {
+		gf2_matrix_square(square, mat);
+		CopyMem(mat, square, sizeof(mat));
+	}
+
+	/* UNIT is the contribution of 2^n repetitions of the pattern
+	   and MAT shifts the register over them. */
+	unit = crc32_raw(0, &pattern, sizeof(pattern));
+	for (; count; count >>= 1) {
+		if (count & 1)
+			c = gf2_matrix_times(mat, c) ^ unit;
+		if (count == 1)
+			break;
+		unit = gf2_matrix_times(mat, unit) ^ unit;
+		gf2_matrix_square(square, mat);
+		CopyMem(mat, square, sizeof(mat));
+	}
+
+	return ~c;
+}
+
+static UINT32 crc32_update(UINT32 crc, const void *data, UINTN len)
+{
+	return ~crc32_raw(~crc, data, len);
+}
+
+/* Copy the next header bytes into DST.  TOTAL is the size of the
+   header in the image, which can be larger than the DST_SIZE bytes we
+   know about: the extra bytes are skipped.  Return TRUE once the
+   complete header has been consumed. */
+static BOOLEAN gather_header(struct sparse_stream *s, CHAR8 **data, UINTN *size,
+			     void *dst, UINTN dst_size, UINTN total)
+{
+	UINTN len;
+
+	if (s->hdr_len < dst_size) {
+		len = min(*size, dst_size - s->hdr_len);
+		CopyMem((CHAR8 *)dst + s->hdr_len, *data, len);
+		s->hdr_len += len;
+		*data += len;
+		*size -= len;
+	}
+
+	if (s->hdr_len >= dst_size && s->hdr_len < total) {
+		len = min(*size, total - s->hdr_len);
+		s->hdr_len += len;
+		*data += len;
+		*size -= len;
+	}
+
+	return s->hdr_len == total;
+}
+
+static void next_chunk(struct sparse_stream *s)
+{
+	s->hdr_len = 0;
+	s->chunk++;
+	s->state = s->chunk == s->sph.total_chunks ? SPARSE_DONE : SPARSE_CHUNK_HEADER;
+}
+
+static EFI_STATUS start_chunk(struct sparse_stream *s)
 {
 	EFI_STATUS ret;
-	UINT64 chunk_szb = (UINT64)ckh->chunk_sz * (UINT64)sph->blk_sz;
+	struct chunk_header *ckh = &s->ckh;
+	UINT64 chunk_szb = (UINT64)ckh->chunk_sz * (UINT64)s->sph.blk_sz;
+
+	if (ckh->total_sz < s->sph.chunk_hdr_sz) {
+		error(L"sparse chunk malformated, %d, %d", ckh->total_sz, s->sph.chunk_hdr_sz);
+		return EFI_INVALID_PARAMETER;
+	}
+	s->data_len = ckh->total_sz - s->sph.chunk_hdr_sz;
 
 	switch (ckh->chunk_type) {
 	case CHUNK_TYPE_RAW:
-		if (size % sph->blk_sz || size != chunk_szb) {
+		if (s->data_len != chunk_szb) {
 			error(L"inconsistent raw chunk");
 			return EFI_INVALID_PARAMETER;
 		}
-		return flash_raw_data(data, size);
+		break;
 	case CHUNK_TYPE_DONT_CARE:
 		ret = flush_buffer();
 		if (EFI_ERROR(ret))
 			return ret;
-		return flash_skip(chunk_szb);
-	case CHUNK_TYPE_FILL:
-		ret = flush_buffer();
+		ret = flash_skip(chunk_szb);
 		if (EFI_ERROR(ret))
 			return ret;
-		return flash_fill(*((UINT32 *) data), chunk_szb);
+		if (s->crc_tracked)
+			s->crc = crc32_fill(s->crc, 0, chunk_szb);
+		break;
+	case CHUNK_TYPE_FILL:
 	case CHUNK_TYPE_CRC32:
-		debug(L"crc chunk not implemented yet %d", size);
+		if (s->data_len != sizeof(s->chunk_data)) {
+			error(L"inconsistent chunk %04x size %ld", ckh->chunk_type, s->data_len);
+			return EFI_INVALID_PARAMETER;
+		}
 		break;
 	default:
 		error(L"Unknow chunk type %04x", ckh->chunk_type);
 		return EFI_INVALID_PARAMETER;
 	}
+
+	s->hdr_len = 0;
+	if (s->data_len)
+		s->state = SPARSE_CHUNK_DATA;
+	else
+		next_chunk(s);
+
 	return EFI_SUCCESS;
 }
 
-EFI_STATUS flash_sparse(void *data, UINT64 size)
+static EFI_STATUS end_chunk(struct sparse_stream *s)
 {
-	struct sparse_header *sph;
-	CHAR8 *s;
-	UINT64 rlen;
-	unsigned int i;
-	EFI_STATUS ret_flush_buffer, ret = EFI_SUCCESS;
+	EFI_STATUS ret;
+	UINT64 chunk_szb = (UINT64)s->ckh.chunk_sz * (UINT64)s->sph.blk_sz;
 
-	rlen = size;
-	s = data;
-	sph = data;
-	s += sph->file_hdr_sz;
+	switch (s->ckh.chunk_type) {
+	case CHUNK_TYPE_FILL:
+		ret = flush_buffer();
+		if (EFI_ERROR(ret))
+			return ret;
+		ret = flash_fill(s->chunk_data, chunk_szb);
+		if (EFI_ERROR(ret))
+			return ret;
+		if (s->crc_tracked)
+			s->crc = crc32_fill(s->crc, s->chunk_data, chunk_szb);
+		break;
+	case CHUNK_TYPE_CRC32:
+		/* Without an image checksum, the CRC is only computed
+		   from the first CRC32 chunk on, and that chunk is taken
+		   as is: it cannot be checked.  */
+		if (!s->crc_tracked) {
+			debug(L"sparse chunk %d: tracking CRC32 from here", s->chunk);
+			s->crc = s->chunk_data;
+			s->crc_tracked = TRUE;
+		} else if (s->chunk_data != s->crc) {
+			error(L"sparse chunk %d: CRC32 mismatch, expected %08x, computed %08x",
+			      s->chunk, s->chunk_data, s->crc);
+			return EFI_CRC_ERROR;
+		}
+		break;
+	}
 
+	next_chunk(s);
+	return EFI_SUCCESS;
+}
+
+/* Write the RAW payload as soon as complete blocks are available.
+   The trailing bytes of an incomplete block are kept in the tail
+   buffer until the next call completes it. */
+static EFI_STATUS feed_raw_data(struct sparse_stream *s, CHAR8 **data, UINTN *size)
+{
+	EFI_STATUS ret;
+	UINTN len, blk_sz = s->sph.blk_sz;
+
+	len = min(*size, s->data_len);
+
+	if (s->tail_len) {
+		len = min(len, blk_sz - s->tail_len);
+		CopyMem(s->tail + s->tail_len, *data, len);
+		s->tail_len += len;
+		if (s->tail_len == blk_sz) {
+			ret = flash_raw_data(s->tail, blk_sz, FALSE);
+			if (EFI_ERROR(ret))
+				return ret;
+			s->tail_len = 0;
+		}
+	} else if (len < blk_sz) {
+		CopyMem(s->tail, *data, len);
+		s->tail_len = len;
+	} else {
+		len -= len % blk_sz;
+		ret = flash_raw_data(*data, len, TRUE);
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+
+	if (s->crc_tracked)
+		s->crc = crc32_update(s->crc, *data, len);
+	*data += len;
+	*size -= len;
+	s->data_len -= len;
+
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS sparse_stream_init(struct sparse_stream *s)
+{
+	if (!s)
+		return EFI_INVALID_PARAMETER;
+
+	ZeroMem(s, sizeof(*s));
+	s->state = SPARSE_FILE_HEADER;
+	crc32_init_table();
 	init_buffer();
 
-	for (i = 0; i < sph->total_chunks; i++) {
-		struct chunk_header *ckh;
-		ckh = (struct chunk_header *) s;
+	return EFI_SUCCESS;
+}
 
-		if (rlen < sph->chunk_hdr_sz || rlen < ckh->total_sz) {
-			error(L"sparse chunk truncated, %ld, %ld", rlen, size);
-			ret = EFI_INVALID_PARAMETER;
+static EFI_STATUS feed(struct sparse_stream *s, void *data, UINTN size)
+{
+	EFI_STATUS ret;
+	CHAR8 *p = data;
+	UINTN len;
+
+	while (size) {
+		switch (s->state) {
+		case SPARSE_FILE_HEADER:
+			if (s->hdr_len < sizeof(s->sph)) {
+				if (!gather_header(s, &p, &size, &s->sph,
+						   sizeof(s->sph), sizeof(s->sph)))
+					break;
+				if (!is_sparse_image(&s->sph, sizeof(s->sph)) ||
+				    !s->sph.blk_sz || s->sph.blk_sz % sizeof(UINT32)) {
+					error(L"Invalid sparse header");
+					return EFI_INVALID_PARAMETER;
+				}
+				s->tail = AllocatePool(s->sph.blk_sz);
+				if (!s->tail)
+					return EFI_OUT_OF_RESOURCES;
+			}
+			if (!gather_header(s, &p, &size, &s->sph,
+					   sizeof(s->sph), s->sph.file_hdr_sz))
+				break;
+			s->hdr_len = 0;
+			s->crc_tracked = s->sph.image_checksum != 0;
+			s->state = s->sph.total_chunks ? SPARSE_CHUNK_HEADER : SPARSE_DONE;
 			break;
-		}
-		if (ckh->total_sz < sph->chunk_hdr_sz) {
-			error(L"sparse chunk malformated, %d, %d", ckh->total_sz, sph->chunk_hdr_sz);
-			ret = EFI_INVALID_PARAMETER;
+
+		case SPARSE_CHUNK_HEADER:
+			if (!gather_header(s, &p, &size, &s->ckh,
+					   sizeof(s->ckh), s->sph.chunk_hdr_sz))
+				break;
+			ret = start_chunk(s);
+			if (EFI_ERROR(ret))
+				return ret;
 			break;
-		}
-		ret = flash_chunk(sph, ckh, s + sph->chunk_hdr_sz, ckh->total_sz - sph->chunk_hdr_sz);
-		if (EFI_ERROR(ret))
+
+		case SPARSE_CHUNK_DATA:
+			switch (s->ckh.chunk_type) {
+			case CHUNK_TYPE_RAW:
+				ret = feed_raw_data(s, &p, &size);
+				if (EFI_ERROR(ret))
+					return ret;
+				if (!s->data_len)
+					next_chunk(s);
+				break;
+			case CHUNK_TYPE_FILL:
+			case CHUNK_TYPE_CRC32:
+				if (!gather_header(s, &p, &size, &s->chunk_data,
+						   sizeof(s->chunk_data), sizeof(s->chunk_data)))
+					break;
+				ret = end_chunk(s);
+				if (EFI_ERROR(ret))
+					return ret;
+				break;
+			default:
+				/* DONT_CARE payload is ignored. */
+				len = min((UINT64)size, s->data_len);
+				s->data_len -= len;
+				p += len;
+				size -= len;
+				if (!s->data_len)
+					next_chunk(s);
+				break;
+			}
 			break;
 
-		s += ckh->total_sz;
-		rlen -= ckh->total_sz;
+		case SPARSE_DONE:
+			/* Trailing bytes after the last chunk are ignored. */
+			return EFI_SUCCESS;
+		}
+	}
+
+	return EFI_SUCCESS;
+}
+
+/* RAW data is written in place from DATA: wait for these writes to
+   complete as the caller may reuse DATA once we return. */
+EFI_STATUS sparse_stream_feed(struct sparse_stream *s, void *data, UINTN size)
+{
+	EFI_STATUS ret, ret_sync;
+
+	flash_profile_begin(FLASH_STAGE_SPARSE);
+	ret = feed(s, data, size);
+	flash_profile_end(FLASH_STAGE_SPARSE, size);
+	ret_sync = flash_sync();
+
+	return EFI_ERROR(ret) ? ret : ret_sync;
+}
+
+EFI_STATUS sparse_stream_finish(struct sparse_stream *s)
+{
+	EFI_STATUS ret = EFI_SUCCESS, ret_flush_buffer, ret_sync;
+
+	if (s->state != SPARSE_DONE) {
+		error(L"sparse image truncated at chunk %d/%d",
+		      s->chunk, s->sph.total_chunks);
+		ret = EFI_INVALID_PARAMETER;
+	} else if (s->sph.image_checksum && s->sph.image_checksum != s->crc) {
+		error(L"sparse image CRC32 mismatch, expected %08x, computed %08x",
+		      s->sph.image_checksum, s->crc);
+		ret = EFI_CRC_ERROR;
 	}
 
 	ret_flush_buffer = flush_buffer();
+	ret_sync = flash_sync();
 	free_buffer();
-	return EFI_ERROR(ret) ? ret : ret_flush_buffer;
+	if (s->tail) {
+		FreePool(s->tail);
+		s->tail = NULL;
+	}
+
+	if (EFI_ERROR(ret))
+		return ret;
+	return EFI_ERROR(ret_flush_buffer) ? ret_flush_buffer : ret_sync;
+}
+
+/* Drop the state of an image which will not be completed.  The
+   queued writes may still read the buffer: wait for them first. */
+void sparse_stream_abort(struct sparse_stream *s)
+{
+	flash_sync();
+	free_buffer();
+	if (s->tail) {
+		FreePool(s->tail);
+		s->tail = NULL;
+	}
+	s->state = SPARSE_DONE;
+}
+
+EFI_STATUS flash_sparse(void *data, UINT64 size)
+{
+	EFI_STATUS ret, ret_finish;
+	struct sparse_stream s;
+
+	ret = sparse_stream_init(&s);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	ret = sparse_stream_feed(&s, data, size);
+	ret_finish = sparse_stream_finish(&s);
+
+	return EFI_ERROR(ret) ? ret : ret_finish;
 }
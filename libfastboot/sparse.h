@@ -36,8 +36,38 @@
 #define _SPARSE_H_
 
 #include <efi.h>
+#include "sparse_format.h"
 
-int is_sparse_image(void *data, UINT64 size);
+enum sparse_stream_state {
+	SPARSE_FILE_HEADER,
+	SPARSE_CHUNK_HEADER,
+	SPARSE_CHUNK_DATA,
+	SPARSE_DONE
+};
+
+/* Incremental sparse image decoder.  The image can be fed in pieces
+   of any size: the decoder keeps the partially received headers and
+   the trailing bytes of an incomplete RAW block across calls. */
+struct sparse_stream {
+	enum sparse_stream_state state;
+	struct sparse_header sph;
+	struct chunk_header ckh;
+	UINT32 chunk_data;	/* FILL pattern or CRC32 value */
+	UINTN hdr_len;		/* bytes of the current header received */
+	UINT64 data_len;	/* payload bytes left in the current chunk */
+	UINT32 chunk;		/* index of the current chunk */
+	UINT8 *tail;		/* incomplete RAW block */
+	UINTN tail_len;
+	UINT32 crc;		/* CRC32 of the expanded image so far */
+	BOOLEAN crc_tracked;	/* whether CRC is kept up to date */
+};
+
+BOOLEAN is_sparse_image(void *data, UINT64 size);
 EFI_STATUS flash_sparse(void *data, UINT64 size);
 
+EFI_STATUS sparse_stream_init(struct sparse_stream *s);
+EFI_STATUS sparse_stream_feed(struct sparse_stream *s, void *data, UINTN size);
+EFI_STATUS sparse_stream_finish(struct sparse_stream *s);
+void sparse_stream_abort(struct sparse_stream *s);
+
 #endif	/* _SPARSE_H_ */
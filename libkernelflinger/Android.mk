@@ -111,6 +111,7 @@ LOCAL_SRC_FILES := \
 	em.c \
 	gpt.c \
 	storage.c \
+	aio.c \
 	pci.c \
 	mmc.c \
 	ufs.c \
@@ -126,6 +127,7 @@ LOCAL_SRC_FILES := \
 	life_cycle.c \
 	qsort.c \
 	timer.c \
+	trace.c \
 	nvme.c \
 	virtual_media.c \
 	general_block.c \
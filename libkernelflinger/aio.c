@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2022, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <efi.h>
+#include <efilib.h>
+#include <lib.h>
+#include "aio.h"
+#include "protocol/BlockIo2.h"
+
+/* Number of write requests kept in flight. */
+#define AIO_MAX_REQUESTS 8
+
+struct aio_request {
+	EFI_BLOCK_IO2_TOKEN token;
+	EFI_LBA lba;
+};
+
+struct aio {
+	EFI_BLOCK_IO *bio;
+	EFI_BLOCK_IO2_PROTOCOL *bio2;
+	struct aio_request req[AIO_MAX_REQUESTS];
+	UINTN head;		/* oldest in-flight request */
+	UINTN count;		/* number of in-flight requests */
+	UINT64 submitted;
+	UINT64 completed;
+	EFI_STATUS status;	/* first error encountered */
+	BOOLEAN abandoned;	/* requests left to the firmware */
+};
+
+static EFI_GUID block_io2_guid = EFI_BLOCK_IO2_PROTOCOL_GUID;
+
+/* The Block IO 2 protocol is installed on the same handle as the
+   Block IO protocol of the device. */
+static EFI_BLOCK_IO2_PROTOCOL *get_block_io2(EFI_BLOCK_IO *bio)
+{
+	EFI_STATUS ret;
+	EFI_HANDLE *handles;
+	UINTN i, nb_handle = 0;
+	EFI_BLOCK_IO *cur;
+	EFI_BLOCK_IO2_PROTOCOL *bio2 = NULL;
+
+	ret = uefi_call_wrapper(BS->LocateHandleBuffer, 5, ByProtocol,
+				&block_io2_guid, NULL, &nb_handle, &handles);
+	if (EFI_ERROR(ret))
+		return NULL;
+
+	for (i = 0; i < nb_handle; i++) {
+		ret = uefi_call_wrapper(BS->HandleProtocol, 3, handles[i],
+					&BlockIoProtocol, (VOID **)&cur);
+		if (EFI_ERROR(ret) || cur != bio)
+			continue;
+
+		ret = uefi_call_wrapper(BS->HandleProtocol, 3, handles[i],
+					&block_io2_guid, (VOID **)&bio2);
+		if (EFI_ERROR(ret))
+			bio2 = NULL;
+		break;
+	}
+
+	FreePool(handles);
+	return bio2;
+}
+
+static void close_events(struct aio *aio)
+{
+	UINTN i;
+
+	for (i = 0; i < ARRAY_SIZE(aio->req); i++) {
+		if (!aio->req[i].token.Event)
+			continue;
+		uefi_call_wrapper(BS->CloseEvent, 1, aio->req[i].token.Event);
+		aio->req[i].token.Event = NULL;
+	}
+}
+
+EFI_STATUS aio_open(EFI_BLOCK_IO *bio, struct aio **aio_p)
+{
+	EFI_STATUS ret;
+	struct aio *aio;
+	UINTN i;
+
+	if (!bio || !aio_p)
+		return EFI_INVALID_PARAMETER;
+
+	aio = AllocateZeroPool(sizeof(*aio));
+	if (!aio)
+		return EFI_OUT_OF_RESOURCES;
+
+	aio->bio = bio;
+	aio->bio2 = get_block_io2(bio);
+	if (!aio->bio2)
+		debug(L"Block IO 2 not available, using synchronous writes");
+
+	for (i = 0; aio->bio2 && i < ARRAY_SIZE(aio->req); i++) {
+		ret = uefi_call_wrapper(BS->CreateEvent, 5, 0, 0, NULL, NULL,
+					&aio->req[i].token.Event);
+		if (EFI_ERROR(ret)) {
+			efi_perror(ret, L"Failed to create Block IO 2 event");
+			close_events(aio);
+			aio->bio2 = NULL;
+		}
+	}
+
+	*aio_p = aio;
+	return EFI_SUCCESS;
+}
+
+/* The in-flight requests cannot be waited for: have the device drop
+   them.  If it cannot, the firmware may still complete them into
+   their tokens which must then never be released. */
+static void abort_requests(struct aio *aio)
+{
+	EFI_STATUS ret;
+
+	ret = uefi_call_wrapper(aio->bio2->Reset, 2, aio->bio2, FALSE);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to abort the in-flight writes");
+		aio->abandoned = TRUE;
+		return;
+	}
+
+	aio->count = 0;
+}
+
+static EFI_STATUS complete_oldest(struct aio *aio)
+{
+	EFI_STATUS ret;
+	struct aio_request *req = &aio->req[aio->head];
+	UINTN index;
+
+	if (aio->abandoned)
+		return aio->status;
+
+	ret = uefi_call_wrapper(BS->WaitForEvent, 3, 1, &req->token.Event, &index);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to wait for the write at lba %ld", req->lba);
+		if (!EFI_ERROR(aio->status))
+			aio->status = ret;
+		abort_requests(aio);
+		return ret;
+	}
+
+	if (EFI_ERROR(req->token.TransactionStatus)) {
+		efi_perror(req->token.TransactionStatus, L"Failed to write at lba %ld",
+			   req->lba);
+		if (!EFI_ERROR(aio->status))
+			aio->status = req->token.TransactionStatus;
+	}
+
+	aio->head = (aio->head + 1) % ARRAY_SIZE(aio->req);
+	aio->count--;
+	aio->completed++;
+
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS aio_write(struct aio *aio, EFI_LBA lba, UINTN size, VOID *data, UINT64 *seq)
+{
+	EFI_STATUS ret;
+	struct aio_request *req;
+
+	if (!aio)
+		return EFI_INVALID_PARAMETER;
+
+	if (EFI_ERROR(aio->status))
+		return aio->status;
+
+	if (!aio->bio2) {
+		ret = uefi_call_wrapper(aio->bio->WriteBlocks, 5, aio->bio,
+					aio->bio->Media->MediaId, lba, size, data);
+		if (EFI_ERROR(ret)) {
+			efi_perror(ret, L"Failed to write at lba %ld", lba);
+			return ret;
+		}
+		aio->completed = ++aio->submitted;
+		goto out;
+	}
+
+	if (aio->count == ARRAY_SIZE(aio->req)) {
+		ret = complete_oldest(aio);
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+
+	req = &aio->req[(aio->head + aio->count) % ARRAY_SIZE(aio->req)];
+	req->lba = lba;
+	req->token.TransactionStatus = EFI_SUCCESS;
+	ret = uefi_call_wrapper(aio->bio2->WriteBlocksEx, 6, aio->bio2,
+				aio->bio2->Media->MediaId, lba, &req->token,
+				size, data);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to queue the write at lba %ld", lba);
+		return ret;
+	}
+
+	aio->count++;
+	aio->submitted++;
+
+out:
+	if (seq)
+		*seq = aio->submitted;
+	return aio->status;
+}
+
+/* Wait for the completion of all the writes up to SEQ.  Requests are
+   retired in submission order. */
+EFI_STATUS aio_wait(struct aio *aio, UINT64 seq)
+{
+	EFI_STATUS ret;
+
+	if (!aio)
+		return EFI_INVALID_PARAMETER;
+
+	while (aio->count && aio->completed < seq) {
+		ret = complete_oldest(aio);
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+
+	return aio->status;
+}
+
+/* Wait for all the in-flight writes and return the first error
+   encountered since the previous flush. */
+EFI_STATUS aio_flush(struct aio *aio)
+{
+	EFI_STATUS ret;
+
+	if (!aio)
+		return EFI_INVALID_PARAMETER;
+
+	ret = aio_wait(aio, aio->submitted);
+	if (!aio->count)
+		aio->status = EFI_SUCCESS;
+
+	return ret;
+}
+
+EFI_STATUS aio_close(struct aio *aio)
+{
+	EFI_STATUS ret;
+
+	if (!aio)
+		return EFI_SUCCESS;
+
+	ret = aio_flush(aio);
+	if (aio->abandoned)
+		return ret;
+
+	close_events(aio);
+	FreePool(aio);
+
+	return ret;
+}
@@ -52,6 +52,7 @@
 #include "slot.h"
 #include "pae.h"
 #include "timer.h"
+#include "trace.h"
 #include "android_vb2.h"
 #include "acpi.h"
 #ifdef USE_FIRSTSTAGE_MOUNT
@@ -63,6 +64,7 @@
 
 #include "uefi_utils.h"
 #include "libxbc.h"
+#include "mp_services.h"
 
 #define OS_INITIATED L"os_initiated"
 
@@ -524,6 +526,56 @@ UINTN bootimage_size(struct boot_img_hdr *aosp_header)
 }
 
 
+EFI_STATUS android_image_size(VOID *image_hdr, UINTN *size)
+{
+        struct boot_img_hdr *aosp_header = image_hdr;
+        UINT32 page_size;
+
+        if (!memcmp(image_hdr, BOOT_MAGIC, BOOT_MAGIC_SIZE)) {
+                if (aosp_header->header_version < BOOT_HEADER_V3) {
+                        if (!aosp_header->page_size)
+                                return EFI_INVALID_PARAMETER;
+                        *size = bootimage_size(aosp_header);
+                } else {
+                        struct boot_img_hdr_v3 *boot_hdr = image_hdr;
+
+                        *size = BOOT_IMG_HEADER_SIZE_V3 +
+                                ALIGN(boot_hdr->kernel_size, BOOT_IMG_HEADER_SIZE_V3) +
+                                ALIGN(boot_hdr->ramdisk_size, BOOT_IMG_HEADER_SIZE_V3);
+                        if (boot_hdr->header_version >= BOOT_HEADER_V4)
+                                *size += ALIGN(((struct boot_img_hdr_v4 *)image_hdr)->signature_size,
+                                               BOOT_IMG_HEADER_SIZE_V4);
+                }
+                return EFI_SUCCESS;
+        }
+
+        if (!memcmp(image_hdr, VENDOR_BOOT_MAGIC, VENDOR_BOOT_MAGIC_SIZE)) {
+                struct vendor_boot_img_hdr_v3 *vendor_hdr = image_hdr;
+
+                page_size = vendor_hdr->page_size;
+                if (!page_size)
+                        return EFI_INVALID_PARAMETER;
+
+                if (vendor_hdr->header_version < BOOT_HEADER_V4) {
+                        *size = ALIGN(sizeof(*vendor_hdr), page_size) +
+                                ALIGN(vendor_hdr->vendor_ramdisk_size, page_size) +
+                                ALIGN(vendor_hdr->dtb_size, page_size);
+                } else {
+                        struct vendor_boot_img_hdr_v4 *vendor_hdr4 = image_hdr;
+
+                        *size = ALIGN(sizeof(*vendor_hdr4), page_size) +
+                                ALIGN(vendor_hdr4->vendor_ramdisk_size, page_size) +
+                                ALIGN(vendor_hdr4->dtb_size, page_size) +
+                                ALIGN(vendor_hdr4->vendor_ramdisk_table_size, page_size) +
+                                ALIGN(vendor_hdr4->bootconfig_size, page_size);
+                }
+                return EFI_SUCCESS;
+        }
+
+        return EFI_UNSUPPORTED;
+}
+
+
 struct boot_img_hdr *get_bootimage_header(VOID *bootimage_blob)
 {
         struct boot_img_hdr *hdr;
@@ -889,6 +941,9 @@ done:
         return bootreason;
 }
 
+/* Room given to the boot trace on the kernel command line */
+#define BOOT_TRACE_LENGTH 512
+
 EFI_STATUS prepend_command_line(CHAR16 **cmdline, CHAR16 *fmt, ...)
 {
         CHAR16 *old;
@@ -1192,6 +1247,9 @@ static EFI_STATUS setup_command_line(
         struct boot_img_hdr *aosp_header;
         CHAR8 time_str8[128] = {0};
         CHAR16 *time_str16 = NULL;
+#ifndef USER
+        CHAR8 trace_str8[BOOT_TRACE_LENGTH];
+#endif
         EFI_GUID *swap_guid = NULL;
         CHAR8 *abl_cmd_line = NULL;
         BOOLEAN is_uefi = TRUE;
@@ -1350,6 +1408,16 @@ static EFI_STATUS setup_command_line(
                         goto out;
         }
 
+#ifndef USER
+        /* Spans completed so far, the later ones are only reported
+           by fastboot */
+        if (trace_format(trace_str8, sizeof(trace_str8))) {
+                ret = prepend_command_line(&cmdline16, L"androidboot.boottrace=%a", trace_str8);
+                if (EFI_ERROR(ret))
+                        goto out;
+        }
+#endif
+
         if(boot_target != MEMORY)
                 vb_cmdlen = get_vb_cmdlen(vb_data);
 
@@ -1870,7 +1938,9 @@ EFI_STATUS android_image_start_buffer(
         use_ramdisk = !recovery_in_boot_partition() || boot_target == RECOVERY || boot_target == MEMORY;
 #endif
         if (use_ramdisk) {
+                trace_begin("ramdisk-copy");
                 ret = setup_ramdisk(bootimage, vendorbootimage, androidcmd);
+                trace_end();
                 if (EFI_ERROR(ret)) {
                         efi_perror(ret, L"setup_ramdisk");
                         if (androidcmd != NULL)
@@ -1965,6 +2035,198 @@ EFI_STATUS write_bcb(
 }
 
 
+#ifdef __LP64__
+/* Conventional memory is cleared by all the processors, each one
+   taking CLEAR_CHUNK_SIZE bytes at a time from the sorted memory map.
+   The application processors must not use any boot service. */
+#define CLEAR_CHUNK_SIZE (64 * 1024 * 1024)
+#define CPUID_7_EBX_ERMS (1 << 9)
+
+struct clear_memory_ctx {
+        CHAR8 *entries;
+        UINTN nr_entries;
+        UINTN entry_sz;
+        UINTN next;
+        UINT64 offset;
+        volatile UINT32 lock;
+        volatile UINT32 active;  /* workers running */
+        BOOLEAN erms;
+};
+
+static BOOLEAN cpu_has_erms(void)
+{
+        UINT32 reg[4];
+
+        cpuid(0, reg);
+        if (reg[0] < 7)
+                return FALSE;
+
+        cpuid_count(7, 0, reg);
+        return !!(reg[1] & CPUID_7_EBX_ERMS);
+}
+
+/* Fast strings when available, non-temporal stores otherwise so that
+   the caches are not filled with data which is never read back. */
+static void zero_memory(VOID *buf, UINT64 len, BOOLEAN erms)
+{
+        UINT64 *p = buf, n;
+        CHAR8 *c;
+
+        if (erms) {
+                asm volatile("rep stosb"
+                             : "+D" (buf), "+c" (len)
+                             : "a" (0)
+                             : "memory");
+                return;
+        }
+
+        for (n = len / sizeof(*p); n; n--, p++)
+                asm volatile("movnti %1, %0" : "=m" (*p) : "r" (0ULL));
+        asm volatile("sfence" ::: "memory");
+
+        for (c = (CHAR8 *)p, n = len % sizeof(*p); n; n--)
+                *c++ = 0;
+}
+
+/* The stack protector canary lives in page 0 which may be cleared
+   while this function runs: it must not have any local array nor
+   take the address of a local variable. */
+static VOID EFIAPI clear_memory_worker(VOID *arg)
+{
+        struct clear_memory_ctx *ctx = arg;
+        EFI_MEMORY_DESCRIPTOR *entry;
+        UINT64 start, len, size;
+
+        __sync_fetch_and_add(&ctx->active, 1);
+        for (;;) {
+                start = len = 0;
+
+                while (__sync_lock_test_and_set(&ctx->lock, 1))
+                        asm volatile("pause");
+                for (; ctx->next < ctx->nr_entries; ctx->next++, ctx->offset = 0) {
+                        entry = (EFI_MEMORY_DESCRIPTOR *)(ctx->entries + ctx->next * ctx->entry_sz);
+                        size = entry->NumberOfPages * EFI_PAGE_SIZE;
+                        if (entry->Type != EfiConventionalMemory || ctx->offset >= size)
+                                continue;
+
+                        start = entry->PhysicalStart + ctx->offset;
+                        len = min(size - ctx->offset, (UINT64)CLEAR_CHUNK_SIZE);
+                        ctx->offset += len;
+                        break;
+                }
+                __sync_lock_release(&ctx->lock);
+
+                if (!len)
+                        break;
+
+                zero_memory((VOID *)(UINTN)start, len, ctx->erms);
+        }
+        __sync_fetch_and_sub(&ctx->active, 1);
+}
+
+static VOID EFIAPI clear_memory_nop(__attribute__((__unused__)) VOID *arg)
+{
+}
+
+/* Only used to dispatch the application processors without
+   blocking: completion is tracked by the workers themselves as the
+   firmware cannot signal it at TPL_NOTIFY. */
+static EFI_EVENT clear_event;
+
+/* The MP services protocol is only used if there is at least one
+   enabled application processor.  A first dispatch makes sure that
+   anything the firmware allocates to dispatch the processors is
+   allocated before the memory map is read. */
+static MP_SERVICES_PROTOCOL *get_mp_services(void)
+{
+        EFI_GUID mp_guid = EFI_MP_SERVICES_PROTOCOL_GUID;
+        MP_SERVICES_PROTOCOL *mp;
+        UINTN nr_cpus, nr_enabled;
+        EFI_STATUS ret;
+
+        ret = LibLocateProtocol(&mp_guid, (VOID **)&mp);
+        if (EFI_ERROR(ret) || !mp)
+                return NULL;
+
+        ret = uefi_call_wrapper(mp->GetNumberOfProcessors, 3, mp,
+                                &nr_cpus, &nr_enabled);
+        if (EFI_ERROR(ret) || nr_enabled < 2)
+                return NULL;
+
+        if (!clear_event) {
+                ret = uefi_call_wrapper(BS->CreateEvent, 5, 0, 0, NULL,
+                                        NULL, &clear_event);
+                if (EFI_ERROR(ret)) {
+                        efi_perror(ret, L"Failed to create the clear event");
+                        clear_event = NULL;
+                        return NULL;
+                }
+        }
+
+        ret = uefi_call_wrapper(mp->StartupAllAPs, 7, mp, clear_memory_nop,
+                                FALSE, NULL, 0, NULL, NULL);
+        if (EFI_ERROR(ret)) {
+                efi_perror(ret, L"Failed to start the application processors");
+                return NULL;
+        }
+
+        debug(L"Clearing memory with %d processors", nr_enabled);
+        return mp;
+}
+
+/* The context is not on the stack for this function not to be
+   checked by the stack protector. */
+static struct clear_memory_ctx clear_ctx;
+
+static EFI_STATUS clear_memory_mp(MP_SERVICES_PROTOCOL *mp, CHAR8 *entries,
+                                  UINTN nr_entries, UINTN entry_sz)
+{
+        EFI_STATUS ret;
+
+        ZeroMem(&clear_ctx, sizeof(clear_ctx));
+        clear_ctx.entries = entries;
+        clear_ctx.nr_entries = nr_entries;
+        clear_ctx.entry_sz = entry_sz;
+        clear_ctx.erms = cpu_has_erms();
+
+        ret = uefi_call_wrapper(mp->StartupAllAPs, 7, mp, clear_memory_worker,
+                                FALSE, clear_event, 0, &clear_ctx, NULL);
+        if (EFI_ERROR(ret))
+                return ret;
+
+        /* The boot processor takes its share of the chunks as well.
+           Once they are all taken, an application processor which
+           has not started yet has nothing left to do. */
+        clear_memory_worker(&clear_ctx);
+        while (clear_ctx.active)
+                asm volatile("pause");
+
+        return EFI_SUCCESS;
+}
+
+EFI_STATUS android_clear_buffer(VOID *buf, UINT64 len, BOOLEAN use_mp)
+{
+        EFI_MEMORY_DESCRIPTOR entry;
+        MP_SERVICES_PROTOCOL *mp;
+
+        if (!use_mp) {
+                zero_memory(buf, len, cpu_has_erms());
+                return EFI_SUCCESS;
+        }
+
+        mp = get_mp_services();
+        if (!mp)
+                return EFI_UNSUPPORTED;
+
+        ZeroMem(&entry, sizeof(entry));
+        entry.Type = EfiConventionalMemory;
+        entry.PhysicalStart = (UINTN)buf;
+        entry.NumberOfPages = len / EFI_PAGE_SIZE;
+
+        return clear_memory_mp(mp, (CHAR8 *)&entry, 1, sizeof(entry));
+}
+#endif
+
 EFI_STATUS android_clear_memory()
 {
         EFI_STATUS ret = EFI_SUCCESS;
@@ -1976,6 +2238,9 @@ EFI_STATUS android_clear_memory()
         EFI_TPL OldTpl;
 
         UINTN stack_canary = *(UINTN *)STACK_CANARY_LOCATION;
+#ifdef __LP64__
+        MP_SERVICES_PROTOCOL *mp = get_mp_services();
+#endif
 
         OldTpl = uefi_call_wrapper(BS->RaiseTPL, 1, TPL_NOTIFY);
         mem_entries = (CHAR8 *)LibMemoryMap(&nr_entries, &key, &entry_sz, &entry_ver);
@@ -1987,7 +2252,12 @@ EFI_STATUS android_clear_memory()
         sort_memory_map(mem_entries, nr_entries, entry_sz);
         mem_map = mem_entries;
 
-#ifndef __LP64__
+#ifdef __LP64__
+        /* Fall back on the boot processor if the application
+           processors could not complete. */
+        if (mp && !EFI_ERROR(clear_memory_mp(mp, mem_entries, nr_entries, entry_sz)))
+                goto done;
+#else
         ret = pae_init(mem_entries, nr_entries, entry_sz);
         if (EFI_ERROR(ret))
                 goto err;
@@ -2019,7 +2289,9 @@ EFI_STATUS android_clear_memory()
                 }
         }
 
-#ifndef __LP64__
+#ifdef __LP64__
+done:
+#else
 pae_err:
         pae_exit();
 err:
@@ -40,6 +40,7 @@
 #include "gpt_bin.h"
 #include "storage.h"
 #include "pci.h"
+#include "trace.h"
 
 #define PROTECTIVE_MBR 0xEE
 
@@ -265,9 +266,11 @@ static EFI_STATUS gpt_cache_partition(logical_unit_t log_unit)
 	if (sdisk.dio && sdisk.log_unit == log_unit)
 		return EFI_SUCCESS;
 
+	trace_begin("gpt-scan");
 	ret = uefi_call_wrapper(BS->LocateHandleBuffer, 5, ByProtocol, &BlockIoProtocol, NULL, &nb_handle, &handles);
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Failed to locate Block IO Protocol");
+		trace_end();
 		return ret;
 	}
 	debug(L"Found %d block io protocols", nb_handle);
@@ -304,6 +307,7 @@ static EFI_STATUS gpt_cache_partition(logical_unit_t log_unit)
 
 free_handles:
 	FreePool(handles);
+	trace_end();
 	return ret;
 }
 
@@ -201,7 +201,8 @@ static EFI_STATUS mmc_get_erase_block_size(EFI_HANDLE handle, UINTN *erase_blk_s
 		return ret;
 	}
 
-	*erase_blk_size = erase_grp_size;
+	/* The erase group size is a number of 512 bytes sectors. */
+	*erase_blk_size = erase_grp_size * 512;
 
 	return EFI_SUCCESS;
 }
@@ -214,11 +214,11 @@ static EFI_STATUS nvme_erase_blocks(
 	ret = NvmePassthru->GetNamespace(NvmePassthru, (EFI_DEVICE_PATH_PROTOCOL *)nvme_dp, &NamespaceId);
 	debug(L"GetNamespace() ret=%d, NamespaceId=%d", ret, NamespaceId);
 
-	for (blk = start;  blk < end; ) {
-		if (end - blk >= NVME_MAX_WRITE_ZEROS_BLOCKS)
+	for (blk = start;  blk <= end; ) {
+		if (end - blk + 1 >= NVME_MAX_WRITE_ZEROS_BLOCKS)
 			num = NVME_MAX_WRITE_ZEROS_BLOCKS;
 		else
-			num = end - blk;
+			num = end - blk + 1;
 
 		ret = nvme_erase_blocks_impl(NvmePassthru, NamespaceId, blk, num);
 		if (EFI_ERROR(ret))
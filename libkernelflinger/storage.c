@@ -37,6 +37,7 @@
 #include "pci.h"
 #include "protocol/EraseBlock.h"
 #include "timer.h"
+#include "aio.h"
 
 static struct storage *cur_storage;
 static PCI_DEVICE_PATH boot_device = { .Function = -1, .Device = -1 };
@@ -342,11 +343,18 @@ EFI_STATUS fill_with(EFI_BLOCK_IO *bio, EFI_LBA start, EFI_LBA end,
 	UINT64 size;
 	uint32_t total, print_sec, print_prev;
 	EFI_STATUS ret;
+	struct aio *aio;
 
 	debug(L"Fill lba %d -> %d", start, end);
 	if (end <= start)
 		return EFI_INVALID_PARAMETER;
 
+	/* The same pattern buffer is used by all the writes, they can
+	   all be in flight at the same time. */
+	ret = aio_open(bio, &aio);
+	if (EFI_ERROR(ret))
+		return ret;
+
 	total = end - start +1;
 	info_n(L"Erasing ");
 	print_sec = boottime_in_msec() / 1000;
@@ -357,15 +365,21 @@ EFI_STATUS fill_with(EFI_BLOCK_IO *bio, EFI_LBA start, EFI_LBA end,
 		else
 			size = pattern_blocks;
 
-		ret = uefi_call_wrapper(bio->WriteBlocks, 5, bio, bio->Media->MediaId, lba,
-				bio->Media->BlockSize * size, pattern);
+		ret = aio_write(aio, lba, bio->Media->BlockSize * size, pattern, NULL);
 		if (EFI_ERROR(ret)) {
 			efi_perror(ret, L"Failed to erase block %ld", lba);
+			aio_close(aio);
 			return ret;
 		}
 
 		print_progress(lba + size - start, total, boottime_in_msec() / 1000, &print_sec, &print_prev);
 	}
+
+	ret = aio_close(aio);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to erase blocks %ld -> %ld", start, end);
+		return ret;
+	}
 	print_progress(total, total, boottime_in_msec() / 1000, &print_sec, &print_prev);
 	info_n(L"\n");
 
@@ -35,6 +35,7 @@
 #include <efilib.h>
 #include <lib.h>
 #include "timer.h"
+#include "acpi.h"
 
 #define BOOT_STAGE_FIRMWARE "FWS"
 #define BOOT_STAGE_OSLOADER_INIT "LIS"
@@ -78,36 +79,214 @@ __RDTSC (void)
 	return (uint64_t) hi << 32 | lo;
 }
 
-uint32_t get_cpu_freq(void)
+static inline uint32_t __INL(uint16_t port)
+{
+	uint32_t val;
+
+	asm volatile ("inl %1, %0" : "=a" (val) : "Nd" (port));
+	return val;
+}
+
+#define CPUID_HYPERVISOR	(1U << 31)
+#define CPUID_HV_TIMING_INFO	0x40000010
+#define MSR_PLATFORM_INFO	0xce
+#define PM_TIMER_FREQ		3579545			/* Hz */
+#define PM_TIMER_CALIBRATION	(PM_TIMER_FREQ / 200)	/* 5 ms */
+#define PM_TIMER_MAX_READS	1000000
+#define STALL_CALIBRATION	10000			/* us */
+
+/* TSC frequency in kHz, computed once */
+static uint64_t tsc_khz;
+
+static BOOLEAN is_hypervisor_guest(void)
+{
+	uint32_t reg[4];
+
+	cpuid(1, reg);
+	return !!(reg[2] & CPUID_HYPERVISOR);
+}
+
+static uint32_t cpuid_max_leaf(void)
+{
+	uint32_t reg[4];
+
+	cpuid(0, reg);
+	return reg[0];
+}
+
+/* TSC/crystal clock ratio and crystal clock frequency. */
+static uint64_t tsc_khz_from_cpuid_15(void)
+{
+	uint32_t reg[4];
+
+	if (cpuid_max_leaf() < 0x15)
+		return 0;
+
+	cpuid(0x15, reg);
+	if (!reg[0] || !reg[1] || !reg[2])
+		return 0;
+
+	return (uint64_t)reg[2] * reg[1] / reg[0] / 1000;
+}
+
+/* Hypervisor timing information leaf, exposed by VMware and by KVM
+   when it is configured to. */
+static uint64_t tsc_khz_from_hypervisor(void)
+{
+	uint32_t reg[4];
+
+	if (!is_hypervisor_guest())
+		return 0;
+
+	cpuid(0x40000000, reg);
+	if (reg[0] < CPUID_HV_TIMING_INFO)
+		return 0;
+
+	cpuid(CPUID_HV_TIMING_INFO, reg);
+	return reg[0];
+}
+
+/* Count the TSC ticks during PM_TIMER_CALIBRATION ticks of the ACPI
+   power management timer, starting on a timer edge. */
+static uint64_t tsc_khz_from_pm_timer(void)
+{
+	struct FACP_TABLE *facp;
+	uint32_t mask, start, last, now, i;
+	uint16_t port;
+	uint64_t tsc_start;
+	EFI_STATUS ret;
+
+	ret = get_acpi_table((CHAR8 *)"FACP", (VOID **)&facp);
+	if (EFI_ERROR(ret))
+		return 0;
+
+	if (facp->header.length < offsetof(struct FACP_TABLE, flags) + sizeof(facp->flags) ||
+	    !facp->pm_tmr_blk || facp->pm_tmr_blk > 0xffff)
+		return 0;
+
+	port = facp->pm_tmr_blk;
+	mask = facp->flags & FACP_FLAG_TMR_VAL_EXT ? 0xffffffff : 0xffffff;
+
+	last = __INL(port) & mask;
+	for (i = 0; i < PM_TIMER_MAX_READS; i++) {
+		start = __INL(port) & mask;
+		if (start != last)
+			break;
+	}
+	tsc_start = __RDTSC();
+
+	for (; i < PM_TIMER_MAX_READS; i++) {
+		now = __INL(port) & mask;
+		if (((now - start) & mask) >= PM_TIMER_CALIBRATION)
+			return (__RDTSC() - tsc_start) * PM_TIMER_FREQ /
+				((now - start) & mask) / 1000;
+	}
+
+	return 0;
+}
+
+/* Nominal frequency, not as precise as a measurement. */
+static uint64_t tsc_khz_from_cpuid_16(void)
+{
+	uint32_t reg[4];
+
+	if (cpuid_max_leaf() < 0x16)
+		return 0;
+
+	cpuid(0x16, reg);
+	return (uint64_t)(reg[0] & 0xffff) * 1000;
+}
+
+/* Maximum non-turbo ratio times a 100 MHz bus clock.  Guests may
+   not implement this MSR. */
+static uint64_t tsc_khz_from_msr(void)
 {
-	uint32_t cpu_freq;
-	uint32_t max_nb_ratio;
 	msr_t platform_info;
 
-	platform_info.val = __RDMSR (0xce);
-	max_nb_ratio = (platform_info.lo >> 8) & 0xff;
-	cpu_freq = 100 * max_nb_ratio;
+	if (is_hypervisor_guest())
+		return 0;
+
+	platform_info.val = __RDMSR(MSR_PLATFORM_INFO);
+	return (uint64_t)((platform_info.lo >> 8) & 0xff) * 100000;
+}
+
+static uint64_t tsc_khz_from_stall(void)
+{
+	uint64_t start;
+
+	start = __RDTSC();
+	uefi_call_wrapper(BS->Stall, 1, STALL_CALIBRATION);
+	return (__RDTSC() - start) * 1000 / STALL_CALIBRATION;
+}
+
+static const struct tsc_source {
+	const CHAR16 *name;
+	uint64_t (*get_khz)(void);
+} TSC_SOURCES[] = {
+	{ L"CPUID 0x15", tsc_khz_from_cpuid_15 },
+	{ L"hypervisor", tsc_khz_from_hypervisor },
+	{ L"ACPI PM timer", tsc_khz_from_pm_timer },
+	{ L"CPUID 0x16", tsc_khz_from_cpuid_16 },
+	{ L"platform info MSR", tsc_khz_from_msr },
+	{ L"Stall", tsc_khz_from_stall }
+};
+
+uint64_t get_tsc_khz(void)
+{
+	UINTN i;
+
+	if (tsc_khz)
+		return tsc_khz;
+
+	for (i = 0; i < ARRAY_SIZE(TSC_SOURCES); i++) {
+		tsc_khz = TSC_SOURCES[i].get_khz();
+		if (tsc_khz) {
+			debug(L"TSC frequency %ld kHz from %s", tsc_khz,
+			      TSC_SOURCES[i].name);
+			break;
+		}
+	}
 
-	return cpu_freq;
+	return tsc_khz;
+}
+
+uint32_t get_cpu_freq(void)
+{
+	return (get_tsc_khz() + 500) / 1000;
 }
 
 uint32_t boottime_in_msec(void)
 {
-	uint64_t tick;
-	uint32_t bt_us, bt_ms;
-	uint32_t cpu_freq;
+	uint64_t khz;
 
-	cpu_freq = get_cpu_freq();
-	if (cpu_freq == 0) {
+	khz = get_tsc_khz();
+	if (khz == 0) {
 		 time_stamp = FALSE;
 		 return 0;
 	}
 
-	tick = __RDTSC();
-	bt_us = (((unsigned) (tick >> 6)) / cpu_freq) << 6;
-	bt_ms = bt_us / 1000;
+	return __RDTSC() / khz;
+}
 
-	return bt_ms;
+uint64_t get_tsc(void)
+{
+	return __RDTSC();
+}
+
+uint64_t tsc_to_usec(uint64_t ticks)
+{
+	uint64_t khz;
+
+	khz = get_tsc_khz();
+	if (khz == 0)
+		return 0;
+
+	return ticks / khz * 1000 + ticks % khz * 1000 / khz;
+}
+
+uint64_t boottime_in_usec(void)
+{
+	return tsc_to_usec(__RDTSC());
 }
 
 void set_boottime_stamp(int num)
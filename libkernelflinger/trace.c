@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2022, Intel Corporation
+ * All rights reserved.
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <efi.h>
+#include <efilib.h>
+#include <lib.h>
+#include "timer.h"
+#include "trace.h"
+
+#ifndef TRACE_ENTRIES
+#define TRACE_ENTRIES 128
+#endif
+#define TRACE_MAX_DEPTH 16
+
+static struct trace_span spans[TRACE_ENTRIES];
+static UINT64 total;		/* Number of spans ever begun */
+static UINT64 stack[TRACE_MAX_DEPTH];
+static UINTN depth;
+static UINTN overflow;
+
+void trace_begin(const char *name)
+{
+	struct trace_span *span;
+
+	if (depth == TRACE_MAX_DEPTH) {
+		overflow++;
+		return;
+	}
+
+	span = &spans[total % TRACE_ENTRIES];
+	span->name = name;
+	span->depth = depth;
+	span->end = 0;
+	stack[depth++] = total++;
+	span->begin = get_tsc();
+}
+
+void trace_end(void)
+{
+	UINT64 now = get_tsc(), seq;
+
+	if (overflow) {
+		overflow--;
+		return;
+	}
+
+	if (!depth)
+		return;
+
+	/* The span may have been overwritten while it was open. */
+	seq = stack[--depth];
+	if (total - seq > TRACE_ENTRIES)
+		return;
+
+	spans[seq % TRACE_ENTRIES].end = now;
+}
+
+UINTN trace_count(void)
+{
+	return min(total, (UINT64)TRACE_ENTRIES);
+}
+
+const struct trace_span *trace_get(UINTN index)
+{
+	if (index >= trace_count())
+		return NULL;
+
+	return &spans[(total - trace_count() + index) % TRACE_ENTRIES];
+}
+
+/* efi_snprintf() silently truncates: each span is formatted on its
+   own to only keep the complete ones. */
+UINTN trace_format(CHAR8 *buf, UINTN size)
+{
+	const struct trace_span *span;
+	CHAR8 entry[96];
+	UINTN i, len = 0;
+	int n;
+
+	if (!buf || !size)
+		return 0;
+
+	buf[0] = '\0';
+	for (i = 0; i < trace_count(); i++) {
+		span = trace_get(i);
+		if (!span->end)
+			continue;
+
+		n = efi_snprintf(entry, sizeof(entry), (CHAR8 *)"%a%a:%ld+%ld",
+				 len ? "," : "", span->name,
+				 tsc_to_usec(span->begin),
+				 tsc_to_usec(span->end - span->begin));
+		if (n < 0 || (UINTN)n >= size - len)
+			break;
+
+		CopyMem(buf + len, entry, n + 1);
+		len += n;
+	}
+
+	return len;
+}
@@ -32,10 +32,63 @@
 
 #include <lib.h>
 #include <transport.h>
+#include <timer.h>
 
 static transport_t *transports;
 static UINTN nb_transport;
 static transport_t *current;
+static data_callback_t rx_callback;
+static data_callback_t tx_callback;
+
+static const UINT64 LATENCY_BUCKETS_USEC[TRANSPORT_LATENCY_BUCKETS - 1] = {
+	100, 1000, 10000, 100000, 1000000
+};
+
+static void stats_submit(struct transport_dir_stats *stats)
+{
+	if (stats->pending++ == 0)
+		stats->start = boottime_in_usec();
+}
+
+/* Requests complete in order, the latency of a request is measured
+   from its submission or the previous completion, whichever is the
+   latest. */
+static void stats_complete(struct transport_dir_stats *stats, unsigned len)
+{
+	UINT64 now, elapsed;
+	UINTN i;
+
+	if (!stats->pending)
+		return;
+
+	now = boottime_in_usec();
+	elapsed = now - stats->start;
+
+	stats->bytes += len;
+	stats->transfers++;
+	stats->busy_usec += elapsed;
+	for (i = 0; i < ARRAY_SIZE(LATENCY_BUCKETS_USEC); i++)
+		if (elapsed < LATENCY_BUCKETS_USEC[i])
+			break;
+	stats->latency[i]++;
+
+	stats->start = now;
+	stats->pending--;
+}
+
+static void transport_rx_done(void *buf, unsigned len)
+{
+	if (current)
+		stats_complete(&current->stats.rx, len);
+	rx_callback(buf, len);
+}
+
+static void transport_tx_done(void *buf, unsigned len)
+{
+	if (current)
+		stats_complete(&current->stats.tx, len);
+	tx_callback(buf, len);
+}
 
 EFI_STATUS transport_register(transport_t *trans, UINTN nb)
 {
@@ -64,9 +117,14 @@ EFI_STATUS transport_start(start_callback_t start_cb,
 	if (!start_cb || !rx_cb || !tx_cb)
 		return EFI_INVALID_PARAMETER;
 
+	rx_callback = rx_cb;
+	tx_callback = tx_cb;
+
 	for (i = 0; i < nb_transport; i++) {
 		current = &transports[i];
-		ret = current->start(start_cb, rx_cb, tx_cb);
+		ZeroMem(&current->stats, sizeof(current->stats));
+		ret = current->start(start_cb, transport_rx_done,
+				     transport_tx_done);
 		if (!EFI_ERROR(ret))
 			break;
 		current = NULL;
@@ -102,12 +160,80 @@ EFI_STATUS transport_run(void)
 	return current ? current->run() : EFI_NOT_STARTED;
 }
 
+/* The submission is accounted before the request is issued because
+   some transports complete it synchronously. */
 EFI_STATUS transport_read(void *buf, UINT32 size)
 {
-	return current ? current->read(buf, size) : EFI_NOT_STARTED;
+	EFI_STATUS ret;
+
+	if (!current)
+		return EFI_NOT_STARTED;
+
+	stats_submit(&current->stats.rx);
+	ret = current->read(buf, size);
+	if (EFI_ERROR(ret) && current && current->stats.rx.pending)
+		current->stats.rx.pending--;
+
+	return ret;
 }
 
 EFI_STATUS transport_write(void *buf, UINT32 size)
 {
-	return current ? current->write(buf, size) : EFI_NOT_STARTED;
+	EFI_STATUS ret;
+
+	if (!current)
+		return EFI_NOT_STARTED;
+
+	stats_submit(&current->stats.tx);
+	ret = current->write(buf, size);
+	if (EFI_ERROR(ret) && current && current->stats.tx.pending)
+		current->stats.tx.pending--;
+
+	return ret;
+}
+
+void transport_stall_begin(void)
+{
+	if (current && !current->stats.stall_start)
+		current->stats.stall_start = boottime_in_usec();
+}
+
+void transport_stall_end(void)
+{
+	if (!current || !current->stats.stall_start)
+		return;
+
+	current->stats.stall_usec += boottime_in_usec() -
+		current->stats.stall_start;
+	current->stats.stall_start = 0;
+}
+
+const char *transport_get_name(void)
+{
+	return current ? current->name : NULL;
+}
+
+struct transport_stats *transport_get_stats(void)
+{
+	return current ? &current->stats : NULL;
+}
+
+void transport_reset_stats(void)
+{
+	struct transport_dir_stats *dirs[2];
+	UINTN i, pending;
+
+	if (!current)
+		return;
+
+	dirs[0] = &current->stats.rx;
+	dirs[1] = &current->stats.tx;
+	for (i = 0; i < ARRAY_SIZE(dirs); i++) {
+		pending = dirs[i]->pending;
+		ZeroMem(dirs[i], sizeof(*dirs[i]));
+		dirs[i]->pending = pending;
+		if (pending)
+			dirs[i]->start = boottime_in_usec();
+	}
+	current->stats.stall_usec = 0;
 }
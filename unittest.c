@@ -41,6 +41,11 @@
 #include "unittest.h"
 #include "blobstore.h"
 #include "watchdog.h"
+#include "timer.h"
+#include "android.h"
+#include "libavb_user/uefi_avb_util.h"
+#include "udp.h"
+#include "libfastboot/fastboot_udp.h"
 
 /*
  * This is the hardware second timeout value
@@ -84,6 +89,407 @@ static VOID test_keys(VOID)
         }
 }
 
+#define SHA_TEST_MAX_LEN        (4 * 64 + 1)
+#define SHA_BENCH_SIZE          (8 * 1024 * 1024)
+
+static VOID test_sha(VOID)
+{
+        UINT8 c_digest[AVB_SHA256_DIGEST_SIZE];
+        UINT8 accel_digest[AVB_SHA256_DIGEST_SIZE];
+        UINT64 start, c_usec, accel_usec;
+        UINTN len, split, i, failed = 0;
+        UINT32 accel;
+        UINT8 *buf;
+
+        buf = AllocatePool(SHA_BENCH_SIZE);
+        if (!buf) {
+                Print(L"Failed to allocate the test buffer, test Failed\n");
+                return;
+        }
+        for (i = 0; i < SHA_BENCH_SIZE; i++)
+                buf[i] = (UINT8)(i * 131 + 7);
+
+        accel = uefi_avb_sha256(buf, 0, 0, (UINT32)-1, accel_digest);
+        if (!accel) {
+                Print(L"No SHA acceleration on this CPU, nothing to compare\n");
+                goto out;
+        }
+
+        /* Every length up to a few blocks, fed in two parts split at
+           every possible position, must give the same digest. */
+        for (len = 0; len <= SHA_TEST_MAX_LEN; len++) {
+                for (split = 0; split <= len; split++) {
+                        uefi_avb_sha256(buf, len, split, 0, c_digest);
+                        uefi_avb_sha256(buf, len, split, accel, accel_digest);
+                        if (memcmp(c_digest, accel_digest, sizeof(c_digest)))
+                                failed++;
+                }
+        }
+
+        start = get_tsc();
+        uefi_avb_sha256(buf, SHA_BENCH_SIZE, 0, 0, c_digest);
+        c_usec = tsc_to_usec(get_tsc() - start);
+        start = get_tsc();
+        uefi_avb_sha256(buf, SHA_BENCH_SIZE, 0, accel, accel_digest);
+        accel_usec = tsc_to_usec(get_tsc() - start);
+        if (memcmp(c_digest, accel_digest, sizeof(c_digest)))
+                failed++;
+
+        Print(L"sha256 %d MiB: C %lld us, accelerated (0x%x) %lld us\n",
+              SHA_BENCH_SIZE / 1024 / 1024, c_usec, accel, accel_usec);
+        Print(L"%d digest mismatch(es), test %s\n", failed,
+              failed ? L"Failed" : L"Passed");
+out:
+        FreePool(buf);
+}
+
+/* RSA public exponentiation with 32-bit and with 64-bit limbs must
+   give the same result.  Montgomery arithmetic works with any odd
+   modulus so the keys are random numbers rather than real keys. */
+#define RSA_TEST_ROUNDS         16
+
+static UINT32 rsa_rand_state = 0x2545f491;
+
+static UINT32 rsa_rand(void)
+{
+        rsa_rand_state = rsa_rand_state * 1664525 + 1013904223;
+        return rsa_rand_state;
+}
+
+static BOOLEAN rsa_ge(UINT32 *a, UINT32 *n, UINTN len)
+{
+        while (len--)
+                if (a[len] != n[len])
+                        return a[len] > n[len];
+        return TRUE;
+}
+
+/* Serialize an AVB public key for a random modulus of NBITS bits. */
+static UINT8 *rsa_test_key(UINTN nbits, UINTN *key_size)
+{
+        UINTN len = nbits / 32, i, j;
+        UINT32 *n, *rr, carry, inv, borrow;
+        AvbRSAPublicKeyHeader *h;
+        UINT8 *key = NULL, *p;
+
+        n = AllocatePool(2 * len * sizeof(*n));
+        if (!n)
+                return NULL;
+        rr = n + len;
+
+        for (i = 0; i < len; i++) {
+                n[i] = rsa_rand();
+                rr[i] = 0;
+        }
+        n[0] |= 1;
+        n[len - 1] |= 0x80000000;
+
+        /* RR = 2^(2 * NBITS) mod N, by doubling from 1. */
+        rr[0] = 1;
+        for (j = 0; j < 2 * nbits; j++) {
+                carry = rr[len - 1] >> 31;
+                for (i = len - 1; i; i--)
+                        rr[i] = rr[i] << 1 | rr[i - 1] >> 31;
+                rr[0] <<= 1;
+
+                if (!carry && !rsa_ge(rr, n, len))
+                        continue;
+                for (i = 0, borrow = 0; i < len; i++) {
+                        UINT64 d = (UINT64)rr[i] - n[i] - borrow;
+                        rr[i] = (UINT32)d;
+                        borrow = (d >> 32) & 1;
+                }
+        }
+
+        *key_size = sizeof(*h) + 2 * len * sizeof(UINT32);
+        key = AllocatePool(*key_size);
+        if (!key)
+                goto out;
+
+        for (inv = n[0], i = 0; i < 4; i++)
+                inv *= 2 - n[0] * inv;
+        h = (AvbRSAPublicKeyHeader *)key;
+        h->key_num_bits = avb_htobe32(nbits);
+        h->n0inv = avb_htobe32(0 - inv);
+
+        p = key + sizeof(*h);
+        for (i = len; i;) {
+                i--;
+                *(UINT32 *)p = avb_htobe32(n[i]);
+                *(UINT32 *)(p + len * sizeof(UINT32)) = avb_htobe32(rr[i]);
+                p += sizeof(UINT32);
+        }
+
+out:
+        FreePool(n);
+        return key;
+}
+
+static VOID test_rsa(VOID)
+{
+        static const UINTN key_bits[] = { 2048, 4096, 8192 };
+        UINT8 *key, *in, *out32, *out64;
+        UINTN i, j, round, key_size, len, failed = 0;
+        UINT64 start, usec32, usec64;
+
+        for (i = 0; i < ARRAY_SIZE(key_bits); i++) {
+                len = key_bits[i] / 8;
+                key = rsa_test_key(key_bits[i], &key_size);
+                in = AllocatePool(3 * len);
+                if (!key || !in) {
+                        Print(L"Failed to allocate the test buffers, test Failed\n");
+                        goto next;
+                }
+                out32 = in + len;
+                out64 = out32 + len;
+
+                usec32 = usec64 = 0;
+                for (round = 0; round < RSA_TEST_ROUNDS; round++) {
+                        /* A leading zero byte keeps the input below N. */
+                        in[0] = 0;
+                        for (j = 1; j < len; j++)
+                                in[j] = (UINT8)rsa_rand();
+                        CopyMem(out32, in, len);
+                        CopyMem(out64, in, len);
+
+                        start = get_tsc();
+                        if (!uefi_avb_rsa_modpow(key, key_size, out32, len, FALSE))
+                                failed++;
+                        usec32 += tsc_to_usec(get_tsc() - start);
+                        start = get_tsc();
+                        if (!uefi_avb_rsa_modpow(key, key_size, out64, len, TRUE))
+                                failed++;
+                        usec64 += tsc_to_usec(get_tsc() - start);
+
+                        if (memcmp(out32, out64, len) || !memcmp(out32, in, len))
+                                failed++;
+                }
+
+                Print(L"rsa%d x%d: 32-bit limbs %lld us, 64-bit limbs %lld us\n",
+                      key_bits[i], RSA_TEST_ROUNDS, usec32, usec64);
+next:
+                if (key)
+                        FreePool(key);
+                if (in)
+                        FreePool(in);
+        }
+
+        Print(L"%d mismatch(es), test %s\n", failed,
+              failed ? L"Failed" : L"Passed");
+}
+
+#ifdef __LP64__
+#define CLEAR_BENCH_SIZE        (256 * 1024 * 1024)
+
+static BOOLEAN is_zero(UINT64 *buf, UINTN len)
+{
+        UINTN i;
+
+        for (i = 0; i < len / sizeof(*buf); i++)
+                if (buf[i])
+                        return FALSE;
+        return TRUE;
+}
+
+static VOID test_clear_memory(VOID)
+{
+        EFI_PHYSICAL_ADDRESS addr;
+        EFI_STATUS ret;
+        UINT64 start, bsp_usec, mp_usec = 0;
+        UINTN failed = 0;
+        VOID *buf;
+
+        ret = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages,
+                                EfiLoaderData,
+                                EFI_SIZE_TO_PAGES(CLEAR_BENCH_SIZE), &addr);
+        if (EFI_ERROR(ret)) {
+                Print(L"Failed to allocate the test buffer, test Failed\n");
+                return;
+        }
+        buf = (VOID *)(UINTN)addr;
+
+        SetMem(buf, CLEAR_BENCH_SIZE, 0xa5);
+        start = get_tsc();
+        android_clear_buffer(buf, CLEAR_BENCH_SIZE, FALSE);
+        bsp_usec = tsc_to_usec(get_tsc() - start);
+        if (!is_zero(buf, CLEAR_BENCH_SIZE))
+                failed++;
+
+        SetMem(buf, CLEAR_BENCH_SIZE, 0xa5);
+        start = get_tsc();
+        ret = android_clear_buffer(buf, CLEAR_BENCH_SIZE, TRUE);
+        if (!EFI_ERROR(ret)) {
+                mp_usec = tsc_to_usec(get_tsc() - start);
+                if (!is_zero(buf, CLEAR_BENCH_SIZE))
+                        failed++;
+        } else
+                Print(L"No application processor available: %r\n", ret);
+
+        Print(L"clear %d MiB: boot processor %lld us, all processors %lld us\n",
+              CLEAR_BENCH_SIZE / 1024 / 1024, bsp_usec, mp_usec);
+        Print(L"%d buffer(s) not cleared, test %s\n", failed,
+              failed ? L"Failed" : L"Passed");
+
+        uefi_call_wrapper(BS->FreePages, 2, addr,
+                          EFI_SIZE_TO_PAGES(CLEAR_BENCH_SIZE));
+}
+#endif
+
+/* Fastboot over UDP protocol state machine, driven through a
+   loopback in place of the network stack. */
+#define UDP_TEST_PACKET_SIZE    1024
+#define UDP_TEST_TX_SIZE        2000
+
+static struct {
+        CHAR8 response[UDP_MAX_DATAGRAM];
+        UINT32 response_size;
+        UINTN responses;
+        UINTN starts;
+        UINTN rx_calls;
+        UINT32 rx_len;
+        UINTN tx_calls;
+        UINT32 tx_len;
+} udp_loop;
+
+static EFI_STATUS udp_loop_send(void *buf, UINT32 size)
+{
+        udp_loop.responses++;
+        udp_loop.response_size = size;
+        return memcpy_s(udp_loop.response, sizeof(udp_loop.response),
+                        buf, size);
+}
+
+static void udp_loop_start(void)
+{
+        udp_loop.starts++;
+}
+
+static void udp_loop_rx(__attribute__((__unused__)) void *buf, unsigned len)
+{
+        udp_loop.rx_calls++;
+        udp_loop.rx_len = len;
+}
+
+static void udp_loop_tx(__attribute__((__unused__)) void *buf, unsigned len)
+{
+        udp_loop.tx_calls++;
+        udp_loop.tx_len = len;
+}
+
+static void udp_loop_packet(UINT8 id, UINT8 flags, UINT16 seq,
+                            const void *payload, UINT32 size)
+{
+        CHAR8 packet[UDP_MAX_DATAGRAM];
+
+        packet[0] = id;
+        packet[1] = flags;
+        packet[2] = seq >> 8;
+        packet[3] = seq & 0xff;
+        if (size)
+                memcpy_s(packet + UDP_HEADER_SIZE,
+                         sizeof(packet) - UDP_HEADER_SIZE, payload, size);
+        fastboot_udp_process(packet, UDP_HEADER_SIZE + size);
+}
+
+/* Check that the last response carries ID, FLAGS, SEQ and SIZE bytes
+   of payload. */
+static BOOLEAN udp_loop_response(UINT8 id, UINT8 flags, UINT16 seq,
+                                 UINT32 size)
+{
+        return udp_loop.response_size == UDP_HEADER_SIZE + size &&
+                udp_loop.response[0] == id &&
+                udp_loop.response[1] == flags &&
+                udp_loop.response[2] == (CHAR8)(seq >> 8) &&
+                udp_loop.response[3] == (CHAR8)(seq & 0xff);
+}
+
+static UINTN udp_loop_check(BOOLEAN ok, CHAR16 *what)
+{
+        if (!ok)
+                Print(L"UDP %s: unexpected behavior\n", what);
+        return ok ? 0 : 1;
+}
+
+static VOID test_fastboot_udp(VOID)
+{
+        static const CHAR8 init[] = { 0, UDP_PROTOCOL_VERSION,
+                                      UDP_TEST_PACKET_SIZE >> 8,
+                                      UDP_TEST_PACKET_SIZE & 0xff };
+        static CHAR8 tx_buf[UDP_TEST_TX_SIZE];
+        CHAR8 rx_buf[64], last[UDP_MAX_DATAGRAM];
+        UINT32 last_size;
+        UINTN responses, failed = 0;
+
+        memset(&udp_loop, 0, sizeof(udp_loop));
+        fastboot_udp_init(udp_loop_send, udp_loop_start,
+                          udp_loop_rx, udp_loop_tx);
+
+        /* QUERY reports the sequence number to start from. */
+        udp_loop_packet(UDP_ID_QUERY, 0, 0, NULL, 0);
+        failed += udp_loop_check(udp_loop_response(UDP_ID_QUERY, 0, 0, 2) &&
+                                 udp_loop.response[4] == 0 &&
+                                 udp_loop.response[5] == 0, L"query");
+
+        /* INIT negotiates the packet size, a retransmitted INIT gets
+           the same response without restarting the session. */
+        udp_loop_packet(UDP_ID_INIT, 0, 0, init, sizeof(init));
+        failed += udp_loop_check(udp_loop_response(UDP_ID_INIT, 0, 0, 4) &&
+                                 !memcmp(udp_loop.response + UDP_HEADER_SIZE,
+                                         init, sizeof(init)) &&
+                                 udp_loop.starts == 1, L"init");
+        memcpy_s(last, sizeof(last), udp_loop.response, udp_loop.response_size);
+        last_size = udp_loop.response_size;
+        udp_loop_packet(UDP_ID_INIT, 0, 0, init, sizeof(init));
+        failed += udp_loop_check(udp_loop.response_size == last_size &&
+                                 !memcmp(udp_loop.response, last, last_size) &&
+                                 udp_loop.starts == 1, L"init replay");
+
+        /* A command split over a continuation packet is delivered
+           once, when its last packet arrives. */
+        fastboot_udp_read(rx_buf, sizeof(rx_buf));
+        udp_loop_packet(UDP_ID_FASTBOOT, UDP_FLAG_CONTINUATION, 1, "getvar:", 7);
+        failed += udp_loop_check(udp_loop_response(UDP_ID_FASTBOOT, 0, 1, 0) &&
+                                 udp_loop.rx_calls == 0, L"continuation");
+        udp_loop_packet(UDP_ID_FASTBOOT, 0, 2, "version", 7);
+        failed += udp_loop_check(udp_loop_response(UDP_ID_FASTBOOT, 0, 2, 0) &&
+                                 udp_loop.rx_calls == 1 &&
+                                 udp_loop.rx_len == 14 &&
+                                 !memcmp(rx_buf, "getvar:version", 14),
+                                 L"command");
+        udp_loop_packet(UDP_ID_FASTBOOT, 0, 2, "version", 7);
+        failed += udp_loop_check(udp_loop_response(UDP_ID_FASTBOOT, 0, 2, 0) &&
+                                 udp_loop.rx_calls == 1, L"command replay");
+
+        /* Device data goes out in the responses to the host polling
+           packets, a lost response is sent again unchanged. */
+        memset(tx_buf, 0x5a, sizeof(tx_buf));
+        fastboot_udp_write(tx_buf, sizeof(tx_buf));
+        udp_loop_packet(UDP_ID_FASTBOOT, 0, 3, NULL, 0);
+        failed += udp_loop_check(udp_loop_response(UDP_ID_FASTBOOT,
+                                                   UDP_FLAG_CONTINUATION, 3,
+                                                   UDP_TEST_PACKET_SIZE - UDP_HEADER_SIZE) &&
+                                 udp_loop.tx_calls == 0, L"data");
+        memcpy_s(last, sizeof(last), udp_loop.response, udp_loop.response_size);
+        last_size = udp_loop.response_size;
+        udp_loop_packet(UDP_ID_FASTBOOT, 0, 3, NULL, 0);
+        failed += udp_loop_check(udp_loop.response_size == last_size &&
+                                 !memcmp(udp_loop.response, last, last_size),
+                                 L"data replay");
+        udp_loop_packet(UDP_ID_FASTBOOT, 0, 4, NULL, 0);
+        failed += udp_loop_check(udp_loop_response(UDP_ID_FASTBOOT, 0, 4,
+                                                   UDP_TEST_TX_SIZE - UDP_TEST_PACKET_SIZE + UDP_HEADER_SIZE) &&
+                                 udp_loop.tx_calls == 1 &&
+                                 udp_loop.tx_len == UDP_TEST_TX_SIZE, L"data end");
+
+        /* Out of sequence packets are ignored. */
+        responses = udp_loop.responses;
+        udp_loop_packet(UDP_ID_FASTBOOT, 0, 9, NULL, 0);
+        failed += udp_loop_check(udp_loop.responses == responses,
+                                 L"out of sequence");
+
+        Print(L"%d failure(s), test %s\n", failed, failed ? L"Failed" : L"Passed");
+}
+
 #ifdef USE_UI
 static UINT8 fake_hash[] = {0x12, 0x34, 0x56, 0x78, 0x90, 0xAB};
 
@@ -115,6 +521,12 @@ static struct test_suite {
         { L"ux", test_ux },
 #endif
         { L"keys", test_keys },
+        { L"fastboot-udp", test_fastboot_udp },
+#ifdef __LP64__
+        { L"clear-memory", test_clear_memory },
+#endif
+        { L"sha", test_sha },
+        { L"rsa", test_rsa },
         { L"watchdog", test_watchdog }
 };
 